@@ -1,3 +1,4 @@
+import os
 import time
 import subprocess
 
@@ -21,9 +22,20 @@ def timed_check_call(command, name='Checked call', verbose=1):
 
 class FastDNA():
 
-    def __init__(self, fastdna_path, verbose=1):
+    def __init__(self, fastdna_path, verbose=1, lib_path=None):
+        '''
+        Predictions are made in-process through libfastdna.so, found at
+        lib_path or next to the fastdna sources, when it exists; otherwise
+        they call the fastdna binary
+        '''
+        from libfastdna import DEFAULT_LIB_PATH, load_library
         self.fastdna = fastdna_path
         self.verbose = verbose
+        self.lib = None
+        if lib_path is None and os.path.exists(DEFAULT_LIB_PATH):
+            lib_path = DEFAULT_LIB_PATH
+        if lib_path is not None:
+            self.lib = load_library(lib_path)
 
     def train(self, model_path, train_data, train_labels,
               dim=10, k=10,
@@ -72,6 +84,10 @@ class FastDNA():
         Predicts the labels for `input_data`
         Stores the results in `output_path`
         '''
+        if self.lib is not None:
+            return self.predict_in_process(
+                model_path, input_data, output_path, paired=paired,
+                threshold=threshold)
         predict = 'predict-paired' if paired else 'predict'
         # predict one label only for now
         command = '{} {} {} {} 1 {} > {}'.format(
@@ -81,6 +97,43 @@ class FastDNA():
         return timed_check_call(command, name=readout, verbose=self.verbose)
 
 
+    def predict_in_process(self, model_path, input_data, output_path,
+                           paired=False, threshold=0., batch_size=4096):
+        '''
+        Same as make_predictions, through libfastdna.so.
+        Paired-end reads are interleaved in input_data.
+        '''
+        from libfastdna import Model, read_fasta
+
+        start = time.time()
+        model = Model(model_path, lib=self.lib)
+        step = 2 if paired else 1
+        with open(output_path, 'w') as out:
+            batch = []
+            for sequence in read_fasta(input_data):
+                batch.append(sequence)
+                if len(batch) == batch_size * step:
+                    self._write_predictions(model, batch, paired, threshold, out)
+                    batch = []
+            if batch:
+                self._write_predictions(model, batch, paired, threshold, out)
+        end = time.time()
+        if self.verbose > 0:
+            print('Making predictions {} finished, elapsed time {:d}s'.format(
+                model_path.split('/')[-1], int(end-start)))
+        return end-start
+
+    def _write_predictions(self, model, batch, paired, threshold, out):
+        if paired:
+            if len(batch) % 2:
+                raise ValueError('Interleaved reads end with an unpaired read')
+            labels, _ = model.classify_paired(
+                batch[0::2], batch[1::2], k=1, threshold=threshold)
+        else:
+            labels, _ = model.classify(batch, k=1, threshold=threshold)
+        for label in labels[:, 0]:
+            out.write((model.labels[label] if label >= 0 else '') + '\n')
+
     def predict_eval(self, model_path, input_data, input_labels, output_path, paired=False, threshold=0.):
         '''
         Make predictions and evaluate them
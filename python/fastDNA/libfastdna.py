@@ -0,0 +1,169 @@
+import ctypes
+import os
+
+import numpy as np
+
+
+DEFAULT_LIB_PATH = os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), '..', '..', 'libfastdna.so')
+
+
+def load_library(lib_path=None):
+    '''
+    Loads libfastdna.so (built with `make shared`)
+    '''
+    if lib_path is None:
+        lib_path = DEFAULT_LIB_PATH
+    lib = ctypes.CDLL(lib_path)
+
+    lib.fdna_last_error.restype = ctypes.c_char_p
+    lib.fdna_load_model.argtypes = [ctypes.c_char_p]
+    lib.fdna_load_model.restype = ctypes.c_void_p
+    lib.fdna_free_model.argtypes = [ctypes.c_void_p]
+    lib.fdna_dimension.argtypes = [ctypes.c_void_p]
+    lib.fdna_dimension.restype = ctypes.c_int32
+    lib.fdna_nlabels.argtypes = [ctypes.c_void_p]
+    lib.fdna_nlabels.restype = ctypes.c_int32
+    lib.fdna_label.argtypes = [ctypes.c_void_p, ctypes.c_int32]
+    lib.fdna_label.restype = ctypes.c_char_p
+    lib.fdna_new_session.argtypes = [ctypes.c_void_p]
+    lib.fdna_new_session.restype = ctypes.c_void_p
+    lib.fdna_free_session.argtypes = [ctypes.c_void_p]
+    lib.fdna_classify.argtypes = [
+        ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int32,
+        ctypes.c_int32, ctypes.c_float,
+        ctypes.POINTER(ctypes.c_int32), ctypes.POINTER(ctypes.c_float)]
+    lib.fdna_classify.restype = ctypes.c_int
+    lib.fdna_classify_paired.argtypes = [
+        ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p),
+        ctypes.POINTER(ctypes.c_char_p), ctypes.c_int32,
+        ctypes.c_int32, ctypes.c_float, ctypes.c_int,
+        ctypes.POINTER(ctypes.c_int32), ctypes.POINTER(ctypes.c_float)]
+    lib.fdna_classify_paired.restype = ctypes.c_int
+    lib.fdna_embed.argtypes = [
+        ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int32,
+        ctypes.POINTER(ctypes.c_float)]
+    lib.fdna_embed.restype = ctypes.c_int
+    return lib
+
+
+def read_fasta(path):
+    '''
+    Yields the sequences of a FASTA file
+    '''
+    sequence = []
+    with open(path) as f:
+        for line in f:
+            if line.startswith('>'):
+                if sequence:
+                    yield ''.join(sequence)
+                sequence = []
+            else:
+                sequence.append(line.strip())
+    if sequence:
+        yield ''.join(sequence)
+
+
+class Model():
+    '''
+    fastDNA model loaded in-process through libfastdna.so.
+    Each Model owns one inference session: use one Model per thread,
+    or share the weights between threads with Model.session().
+    '''
+
+    def __init__(self, model_path, lib=None, lib_path=None):
+        self.lib = lib if lib is not None else load_library(lib_path)
+        self.model = self.lib.fdna_load_model(model_path.encode())
+        if not self.model:
+            raise ValueError(self.lib.fdna_last_error().decode())
+        self.dim = self.lib.fdna_dimension(self.model)
+        self.labels = [self.lib.fdna_label(self.model, i).decode()
+                       for i in range(self.lib.fdna_nlabels(self.model))]
+        self._session = self.session()
+
+    def session(self):
+        return Session(self)
+
+    def classify(self, sequences, k=1, threshold=0.):
+        return self._session.classify(sequences, k, threshold)
+
+    def classify_paired(self, sequences, mates, k=1, threshold=0., average=False):
+        return self._session.classify_paired(sequences, mates, k, threshold, average)
+
+    def embed(self, sequences):
+        return self._session.embed(sequences)
+
+    def __del__(self):
+        if getattr(self, 'model', None):
+            self._session = None
+            self.lib.fdna_free_model(self.model)
+            self.model = None
+
+
+class Session():
+
+    def __init__(self, model):
+        self.model = model
+        self.lib = model.lib
+        self.session = self.lib.fdna_new_session(model.model)
+        if not self.session:
+            raise ValueError(self.lib.fdna_last_error().decode())
+
+    def _sequences(self, sequences):
+        encoded = [s.encode() for s in sequences]
+        return (ctypes.c_char_p * len(encoded))(*encoded)
+
+    def classify(self, sequences, k=1, threshold=0.):
+        '''
+        Returns two arrays of shape (len(sequences), k): label ids (-1 when
+        there is no prediction) and probabilities. Label names are in
+        Model.labels.
+        '''
+        n = len(sequences)
+        labels = np.empty((n, k), dtype=np.int32)
+        probs = np.empty((n, k), dtype=np.float32)
+        ret = self.lib.fdna_classify(
+            self.session, self._sequences(sequences), n, k, threshold,
+            labels.ctypes.data_as(ctypes.POINTER(ctypes.c_int32)),
+            probs.ctypes.data_as(ctypes.POINTER(ctypes.c_float)))
+        if ret < 0:
+            raise ValueError(self.lib.fdna_last_error().decode())
+        return labels, probs
+
+    def classify_paired(self, sequences, mates, k=1, threshold=0., average=False):
+        '''
+        Same as classify for the pairs (sequences[i], mates[i]), classified
+        by the union of their k-mers, or by the average of the posteriors of
+        both mates if average is set
+        '''
+        if len(mates) != len(sequences):
+            raise ValueError('sequences and mates differ in length')
+        n = len(sequences)
+        labels = np.empty((n, k), dtype=np.int32)
+        probs = np.empty((n, k), dtype=np.float32)
+        ret = self.lib.fdna_classify_paired(
+            self.session, self._sequences(sequences), self._sequences(mates),
+            n, k, threshold, int(average),
+            labels.ctypes.data_as(ctypes.POINTER(ctypes.c_int32)),
+            probs.ctypes.data_as(ctypes.POINTER(ctypes.c_float)))
+        if ret < 0:
+            raise ValueError(self.lib.fdna_last_error().decode())
+        return labels, probs
+
+    def embed(self, sequences):
+        '''
+        Returns an array of shape (len(sequences), dim) of sequence vectors
+        '''
+        n = len(sequences)
+        embeddings = np.empty((n, self.model.dim), dtype=np.float32)
+        ret = self.lib.fdna_embed(
+            self.session, self._sequences(sequences), n,
+            embeddings.ctypes.data_as(ctypes.POINTER(ctypes.c_float)))
+        if ret < 0:
+            raise ValueError(self.lib.fdna_last_error().decode())
+        return embeddings
+
+    def __del__(self):
+        if getattr(self, 'session', None):
+            self.lib.fdna_free_session(self.session)
+            self.session = None
@@ -31,7 +31,11 @@ Args::Args() {
   length = 200;
   noise = 0;
   minn = 3;
-  maxn = 6;
+  maxn = 0;
+  denseK = 12;
+  sampling = sampling_name::all;
+  window = 10;
+  smer = 5;
   thread = 12;
   lrUpdateRate = 100;
   t = 1e-4;
@@ -41,6 +45,21 @@ Args::Args() {
   loadModel = "";
   saveOutput = false;
   freezeEmbeddings = false;
+  statsFile = "";
+  statsInterval = 5;
+  checkpointInterval = 0;
+  resume = false;
+  seed = 0;
+  deterministic = false;
+  coordinator = "";
+  syncInterval = 100000;
+  prefetch = 0;
+  stream = false;
+  shardSize = 16;
+  shuffleBuffer = 10000;
+  prefixStride = 0;
+  incremental = false;
+  replay = 0.5;
 
   qout = false;
   retrain = false;
@@ -61,6 +80,18 @@ std::string Args::lossToString(loss_name ln) const {
   return "Unknown loss!"; // should never happen
 }
 
+std::string Args::samplingToString(sampling_name sn) const {
+  switch (sn) {
+    case sampling_name::all:
+      return "all";
+    case sampling_name::minimizer:
+      return "minimizer";
+    case sampling_name::syncmer:
+      return "syncmer";
+  }
+  return "Unknown sampling!"; // should never happen
+}
+
 std::string Args::boolToString(bool b) const {
   if (b) {
     return "true";
@@ -138,8 +169,8 @@ void Args::parseArgs(const std::vector<std::string>& args) {
           printHelp();
           exit(EXIT_FAILURE);
         }
-      // } else if (args[ai] == "-bucket") {
-      //   bucket = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-bucket") {
+        bucket = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-noise") {
         noise = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-length") {
@@ -148,6 +179,24 @@ void Args::parseArgs(const std::vector<std::string>& args) {
         minn = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-maxn") {
         maxn = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-denseK") {
+        denseK = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-sampling") {
+        if (args.at(ai + 1) == "all") {
+          sampling = sampling_name::all;
+        } else if (args.at(ai + 1) == "minimizer") {
+          sampling = sampling_name::minimizer;
+        } else if (args.at(ai + 1) == "syncmer") {
+          sampling = sampling_name::syncmer;
+        } else {
+          std::cerr << "Unknown sampling: " << args.at(ai + 1) << std::endl;
+          printHelp();
+          exit(EXIT_FAILURE);
+        }
+      } else if (args[ai] == "-window") {
+        window = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-smer") {
+        smer = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-thread") {
         thread = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-t") {
@@ -166,6 +215,40 @@ void Args::parseArgs(const std::vector<std::string>& args) {
       } else if (args[ai] == "-freezeEmbeddings") {
         freezeEmbeddings = true;
         ai--;
+      } else if (args[ai] == "-statsFile") {
+        statsFile = std::string(args.at(ai + 1));
+      } else if (args[ai] == "-statsInterval") {
+        statsInterval = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-checkpointInterval") {
+        checkpointInterval = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-resume") {
+        resume = true;
+        ai--;
+      } else if (args[ai] == "-seed") {
+        seed = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-deterministic") {
+        deterministic = true;
+        ai--;
+      } else if (args[ai] == "-coordinator") {
+        coordinator = std::string(args.at(ai + 1));
+      } else if (args[ai] == "-syncInterval") {
+        syncInterval = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-prefetch") {
+        prefetch = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-stream") {
+        stream = true;
+        ai--;
+      } else if (args[ai] == "-shardSize") {
+        shardSize = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-shuffleBuffer") {
+        shuffleBuffer = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-prefixStride") {
+        prefixStride = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-incremental") {
+        incremental = true;
+        ai--;
+      } else if (args[ai] == "-replay") {
+        replay = std::stof(args.at(ai + 1));
       } else if (args[ai] == "-qnorm") {
         qnorm = true;
         ai--;
@@ -195,7 +278,56 @@ void Args::parseArgs(const std::vector<std::string>& args) {
     printHelp();
     exit(EXIT_FAILURE);
   }
-  if (wordNgrams <= 1 && maxn == 0) {
+  if (denseK > 15) {
+    std::cerr << "Dense k-mer tables are limited to k <= 15." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (sampling == sampling_name::minimizer && window < 1) {
+    std::cerr << "Minimizer window must contain at least one k-mer." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (sampling == sampling_name::syncmer && (smer < 1 || smer >= minn)) {
+    std::cerr << "Syncmer s-mers must be shorter than minn." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (deterministic && (checkpointInterval > 0 || resume || prefetch > 0)) {
+    std::cerr << "Deterministic training does not support checkpoints or prefetching." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (stream && (deterministic || checkpointInterval > 0 || resume ||
+                 prefetch > 0 || shardSize <= 0 || shuffleBuffer <= 0)) {
+    std::cerr << "Streaming training needs a positive -shardSize and -shuffleBuffer, "
+              << "and does not support checkpoints, prefetching or deterministic training." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (prefixStride > 0 && (!freezeEmbeddings || noise > 0 || deterministic ||
+                           stream || prefetch > 0)) {
+    std::cerr << "Cached embedding sums need -freezeEmbeddings without noise, "
+              << "and do not support deterministic, streaming or prefetched training." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (incremental && (loadModel.empty() || replay < 0 || replay > 1 ||
+                      deterministic || stream || prefetch > 0 || prefixStride > 0)) {
+    std::cerr << "Incremental training needs -loadModel and a -replay between 0 and 1, "
+              << "and does not support deterministic, streaming, prefetched or cached training." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!coordinator.empty() &&
+      (deterministic || checkpointInterval > 0 || resume || syncInterval <= 0)) {
+    std::cerr << "Training with a coordinator needs a positive -syncInterval, "
+              << "and does not support checkpoints or deterministic training." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (maxn > 32) {
+    std::cerr << "k-mers longer than 32 are not supported." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (maxn > minn && maxn > denseK) {
+    // some k-mer lengths are hashed
+    if (bucket <= 0) {
+      bucket = 2000000;
+    }
+  } else {
     bucket = 0;
   }
 }
@@ -223,9 +355,13 @@ void Args::printDictionaryHelp() {
     // << "  -minCount           minimal number of word occurences [" << minCount << "]\n"
     // << "  -minCountLabel      minimal number of label occurences [" << minCountLabel << "]\n"
     // << "  -wordNgrams         max length of word ngram [" << wordNgrams << "]\n"
-    // << "  -bucket             number of buckets [" << bucket << "]\n"
-    << "  -minn               min length of char ngram [" << minn << "]\n"
-    << "  -maxn               max length of char ngram [" << maxn << "]\n"
+    << "  -minn               min length of k-mers [" << minn << "]\n"
+    << "  -maxn               max length of k-mers, if greater than minn [" << maxn << "]\n"
+    << "  -denseK             max length of k-mers with a dense table [" << denseK << "]\n"
+    << "  -bucket             number of buckets for longer k-mers [" << bucket << "]\n"
+    << "  -sampling           k-mer sampling {all, minimizer, syncmer} [" << samplingToString(sampling) << "]\n"
+    << "  -window             number of k-mers in a minimizer window [" << window << "]\n"
+    << "  -smer               length of syncmer s-mers [" << smer << "]\n"
     // << "  -t                  sampling threshold [" << t << "]\n"
     << "  -label              labels prefix [" << label << "]\n";
 }
@@ -246,7 +382,22 @@ void Args::printTrainingHelp() {
     << "  -pretrainedVectors  pretrained word vectors for supervised learning ["<< pretrainedVectors <<"]\n"
     << "  -loadModel          pretrained model for supervised learning ["<< loadModel <<"]\n"
     << "  -saveOutput         whether output params should be saved [" << boolToString(saveOutput) << "]\n"
-    << "  -freezeEmbeddings   model does not update the embedding vectors [" << boolToString(freezeEmbeddings) << "]\n";
+    << "  -freezeEmbeddings   model does not update the embedding vectors [" << boolToString(freezeEmbeddings) << "]\n"
+    << "  -prefixStride       with -freezeEmbeddings, stride in bases of cached embedding sums, 0 to disable [" << prefixStride << "]\n"
+    << "  -incremental        with -loadModel, add the new sequences and labels of the input [" << boolToString(incremental) << "]\n"
+    << "  -replay             with -incremental, fraction of fragments drawn from all the sequences [" << replay << "]\n"
+    << "  -statsFile          file to append training statistics to, as JSON lines [" << statsFile << "]\n"
+    << "  -statsInterval      seconds between two training statistics [" << statsInterval << "]\n"
+    << "  -checkpointInterval seconds between two checkpoints to <output>.checkpoint, 0 to disable [" << checkpointInterval << "]\n"
+    << "  -resume             resume training from <output>.checkpoint [" << boolToString(resume) << "]\n"
+    << "  -seed               seed of the training threads [" << seed << "]\n"
+    << "  -deterministic      reproducible training with synchronized threads [" << boolToString(deterministic) << "]\n"
+    << "  -coordinator        address of a coordinator to train with other workers [" << coordinator << "]\n"
+    << "  -syncInterval       fragments of a worker between two merges with the coordinator [" << syncInterval << "]\n"
+    << "  -prefetch           threads reading fragments ahead of training, 0 to disable [" << prefetch << "]\n"
+    << "  -stream             read the training data sequentially, an epoch being one pass [" << boolToString(stream) << "]\n"
+    << "  -shardSize          size in MB of the shards read at once by -stream [" << shardSize << "]\n"
+    << "  -shuffleBuffer      fragments of the shuffle buffer of each thread with -stream [" << shuffleBuffer << "]\n";
 }
 
 void Args::printQuantizationHelp() {
@@ -273,9 +424,13 @@ void Args::save(std::ostream& out) {
   out.write((char*) &(maxn), sizeof(int));
   out.write((char*) &(lrUpdateRate), sizeof(int));
   out.write((char*) &(t), sizeof(double));
+  out.write((char*) &(denseK), sizeof(int));
+  out.write((char*) &(sampling), sizeof(sampling_name));
+  out.write((char*) &(window), sizeof(int));
+  out.write((char*) &(smer), sizeof(int));
 }
 
-void Args::load(std::istream& in) {
+void Args::load(std::istream& in, int32_t version) {
   in.read((char*) &(dim), sizeof(int));
   in.read((char*) &(ws), sizeof(int));
   in.read((char*) &(epoch), sizeof(int));
@@ -289,6 +444,14 @@ void Args::load(std::istream& in) {
   in.read((char*) &(maxn), sizeof(int));
   in.read((char*) &(lrUpdateRate), sizeof(int));
   in.read((char*) &(t), sizeof(double));
+  if (version >= 13) {
+    in.read((char*) &(denseK), sizeof(int));
+  }
+  if (version >= 14) {
+    in.read((char*) &(sampling), sizeof(sampling_name));
+    in.read((char*) &(window), sizeof(int));
+    in.read((char*) &(smer), sizeof(int));
+  }
 }
 
 void Args::dump(std::ostream& out) const {
@@ -303,6 +466,10 @@ void Args::dump(std::ostream& out) const {
   out << "bucket" << " " << bucket << std::endl;
   out << "minn" << " " << minn << std::endl;
   out << "maxn" << " " << maxn << std::endl;
+  out << "denseK" << " " << denseK << std::endl;
+  out << "sampling" << " " << samplingToString(sampling) << std::endl;
+  out << "window" << " " << window << std::endl;
+  out << "smer" << " " << smer << std::endl;
   out << "lrUpdateRate" << " " << lrUpdateRate << std::endl;
   out << "t" << " " << t << std::endl;
 }
@@ -18,12 +18,14 @@ namespace fasttext {
 
 enum class model_name : int { cbow = 1, sg, sup };
 enum class loss_name : int { hs = 1, ns, softmax };
+enum class sampling_name : int { all = 1, minimizer, syncmer };
 
 class Args {
   protected:
     std::string lossToString(loss_name) const;
     std::string boolToString(bool) const;
     std::string modelToString(model_name) const;
+    std::string samplingToString(sampling_name) const;
 
   public:
     Args();
@@ -44,6 +46,10 @@ class Args {
     int bucket;
     int minn;
     int maxn;
+    int denseK;
+    sampling_name sampling;
+    int window;
+    int smer;
     int length;
     int noise;
     int thread;
@@ -54,6 +60,21 @@ class Args {
     std::string loadModel;
     bool saveOutput;
     bool freezeEmbeddings;
+    std::string statsFile;
+    int statsInterval;
+    int checkpointInterval;
+    bool resume;
+    int seed;
+    bool deterministic;
+    std::string coordinator;
+    int syncInterval;
+    int prefetch;
+    bool stream;
+    int shardSize;
+    int shuffleBuffer;
+    int prefixStride;
+    bool incremental;
+    double replay;
 
     bool qout;
     bool retrain;
@@ -68,7 +89,7 @@ class Args {
     void printTrainingHelp();
     void printQuantizationHelp();
     void save(std::ostream&);
-    void load(std::istream&);
+    void load(std::istream&, int32_t);
     void dump(std::ostream&) const;
 };
 }
@@ -0,0 +1,462 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+/*
+Micro-benchmarks of the core kernels, built and run by `make bench`.
+Every benchmark runs its kernel in batches of doubling size until it has
+run for at least -time seconds, after one untimed warm-up call. All
+inputs are drawn from fixed seeds so that two builds can be compared.
+Results are printed on stdout as CSV (default) or JSON lines:
+
+  benchmark, params, ops, ns/op, GB/s
+
+where GB/s is the amount of input data (sequence bytes, matrix rows,
+model file) processed per second, or 0 when it is not meaningful.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "dictionary.h"
+#include "fasttext.h"
+#include "matrix.h"
+#include "model.h"
+#include "productquantizer.h"
+#include "qmatrix.h"
+#include "vector.h"
+
+using namespace fasttext;
+
+struct Result {
+  std::string name;
+  std::string params;
+  int64_t ops;
+  double nsPerOp;
+  double gbPerSec;
+};
+
+static double minTime = 0.5;
+static std::string filter;
+static std::vector<Result> results;
+// keeps the compiler from optimizing the kernels away
+static volatile real sink;
+
+static bool enabled(const std::string& name) {
+  return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+// f() performs opsPerCall operations, each reading bytesPerOp bytes
+template <typename F>
+static void run(const std::string& name,
+                const std::string& params,
+                int64_t opsPerCall,
+                double bytesPerOp,
+                F f) {
+  typedef std::chrono::steady_clock clock;
+  f();
+  int64_t calls = 1, total = 0;
+  double elapsed = 0;
+  while (elapsed < minTime) {
+    auto start = clock::now();
+    for (int64_t i = 0; i < calls; i++) {
+      f();
+    }
+    elapsed += std::chrono::duration<double>(clock::now() - start).count();
+    total += calls;
+    calls *= 2;
+  }
+  Result r;
+  r.name = name;
+  r.params = params;
+  r.ops = total * opsPerCall;
+  r.nsPerOp = elapsed * 1e9 / r.ops;
+  r.gbPerSec = bytesPerOp / r.nsPerOp;
+  results.push_back(r);
+  std::cerr << std::left << std::setw(24) << name << std::setw(24) << params
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(14) << r.nsPerOp << " ns/op"
+            << std::setprecision(3) << std::setw(10) << r.gbPerSec << " GB/s"
+            << std::endl;
+}
+
+static std::string randomSequence(std::mt19937_64& rng, int64_t length) {
+  static const char bases[] = "ACGT";
+  std::string seq(length, 'A');
+  for (int64_t i = 0; i < length; i++) {
+    seq[i] = bases[rng() & 3];
+  }
+  return seq;
+}
+
+static std::shared_ptr<Args> supervisedArgs(int32_t k, int32_t dim) {
+  auto args = std::make_shared<Args>();
+  args->model = model_name::sup;
+  args->loss = loss_name::softmax;
+  args->minn = k;
+  args->dim = dim;
+  args->verbose = 0;
+  return args;
+}
+
+static void benchReadSequence() {
+  std::mt19937_64 rng(0);
+  const int32_t length = 150;
+  const int32_t nreads = 1024;
+  std::vector<std::string> reads;
+  for (int32_t i = 0; i < nreads; i++) {
+    reads.push_back(randomSequence(rng, length));
+  }
+  // a single length is always dense, and beyond 15 its table overflows an
+  // index: longer k-mers are read along with k - 1 and hashed
+  for (int32_t k : {8, 12, 16}) {
+    auto args = supervisedArgs(k, 10);
+    std::string params = "k=" + std::to_string(k);
+    if (k > 15) {
+      args->minn = k - 1;
+      args->maxn = k;
+      args->bucket = 2000000;
+      params = "k=" + std::to_string(k - 1) + "-" + std::to_string(k) + " hashed";
+    }
+    Dictionary dict(args);
+    std::vector<fasttext::index> words;
+    run("readSequence", params + " L=150", nreads, length, [&]() {
+      for (auto& read : reads) {
+        dict.readSequence(read, words);
+      }
+      sink = words.size();
+    });
+  }
+}
+
+static void benchComputeIndex() {
+  std::mt19937_64 rng(0);
+  const int32_t n = 4096;
+  for (int32_t k : {8, 12, 15}) {
+    Dictionary dict(supervisedArgs(k, 10));
+    std::vector<std::pair<fasttext::index, fasttext::index>> kmers;
+    for (int32_t i = 0; i < n; i++) {
+      fasttext::index kmer = rng() & ((uint64_t(1) << 2 * k) - 1);
+      fasttext::index kmer_reverse = 0;
+      for (int32_t j = 0; j < k; j++) {
+        kmer_reverse = (kmer_reverse << 2) | (3 - ((kmer >> 2 * j) & 3));
+      }
+      kmers.push_back(std::make_pair(kmer, kmer_reverse));
+    }
+    run("computeIndex", "k=" + std::to_string(k), n, 0, [&]() {
+      fasttext::index sum = 0;
+      for (auto& p : kmers) {
+        sum += dict.computeIndex(p.first, p.second, k);
+      }
+      sink = sum;
+    });
+  }
+}
+
+static void benchComputeHidden() {
+  std::mt19937_64 rng(0);
+  // training the quantizer of large tables would take longer than the
+  // benchmarks, so the quantized matrix is only timed on 6-mers
+  const std::pair<int32_t, int32_t> configs[] = {
+    {6, 16}, {6, 64}, {10, 16}, {10, 64}};
+  for (auto& config : configs) {
+    const int32_t k = config.first, dim = config.second;
+    auto args = supervisedArgs(k, dim);
+    Dictionary dict(args);
+    auto wi = std::make_shared<Matrix>(dict.nwords(), dim);
+    auto wo = std::make_shared<Matrix>(100, dim);
+    wi->uniform(1.0 / dim);
+    wo->zero();
+    Model model(wi, wo, args, 0);
+    std::vector<std::vector<fasttext::index>> reads(256);
+    for (auto& words : reads) {
+      std::string read = randomSequence(rng, 150);
+      dict.readSequence(read, words);
+    }
+    Vector hidden(dim);
+    const std::string params =
+      "k=" + std::to_string(k) + " dim=" + std::to_string(dim) + " L=150";
+    const double bytes = reads[0].size() * dim * sizeof(real);
+    run("computeHidden", params, reads.size(), bytes, [&]() {
+      for (auto& words : reads) {
+        model.computeHidden(words, hidden);
+      }
+      sink = hidden[0];
+    });
+
+    if (k > 6) {
+      continue;
+    }
+    auto qwi = std::make_shared<QMatrix>(*wi, args->dsub, false);
+    model.setQuantizePointer(qwi, nullptr, false);
+    model.quant_ = true;
+    run("computeHidden/quant", params + " dsub=2", reads.size(),
+        reads[0].size() * dim / args->dsub, [&]() {
+      for (auto& words : reads) {
+        model.computeHidden(words, hidden);
+      }
+      sink = hidden[0];
+    });
+  }
+}
+
+static void benchComputeOutputSoftmax() {
+  const int32_t dim = 64;
+  for (int32_t nlabels : {100, 1000, 10000}) {
+    auto args = supervisedArgs(10, dim);
+    auto wi = std::make_shared<Matrix>(1, dim);
+    auto wo = std::make_shared<Matrix>(nlabels, dim);
+    wo->uniform(1.0);
+    Model model(wi, wo, args, 0);
+    Vector hidden(dim), output(nlabels);
+    for (int32_t i = 0; i < dim; i++) {
+      hidden[i] = 1.0 / (i + 1);
+    }
+    run("computeOutputSoftmax",
+        "labels=" + std::to_string(nlabels) + " dim=" + std::to_string(dim),
+        1, double(nlabels) * dim * sizeof(real), [&]() {
+      model.computeOutputSoftmax(hidden, output);
+      sink = output[0];
+    });
+  }
+}
+
+static void benchPredictHs() {
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<real> uniform(-1, 1);
+  const int32_t dim = 64, nb = 64;
+  for (int32_t nlabels : {1000, 10000}) {
+    auto args = supervisedArgs(10, dim);
+    args->loss = loss_name::hs;
+    auto wi = std::make_shared<Matrix>(1, dim);
+    auto wo = std::make_shared<Matrix>(nlabels, dim);
+    wo->zero();
+    Model model(wi, wo, args, 0);
+    std::vector<int64_t> counts(nlabels);
+    for (auto& c : counts) {
+      c = 1 + rng() % 1000;
+    }
+    model.setTargetCounts(counts);
+    // the search prunes the tree of a trained model far more than that of a
+    // random one: the tree is trained on noisy copies of a random hidden
+    // vector per label, and the rows to predict are such copies
+    Matrix prototypes(nlabels, dim);
+    prototypes.uniform(1.0);
+    Vector hidden(dim);
+    auto noisy = [&](int32_t label, real* out) {
+      for (int32_t j = 0; j < dim; j++) {
+        out[j] = prototypes.at(label, j) + 0.3 * uniform(rng);
+      }
+    };
+    for (int32_t epoch = 0; epoch < 10; epoch++) {
+      for (int32_t label = 0; label < nlabels; label++) {
+        noisy(label, hidden.data());
+        model.update(hidden, label, 0.1);
+      }
+    }
+    Matrix hiddens(nb, dim);
+    for (int64_t b = 0; b < nb; b++) {
+      noisy(rng() % nlabels, hiddens.data() + b * dim);
+    }
+    std::vector<std::vector<std::pair<real, int32_t>>> heaps(nb);
+    for (int32_t k : {1, 5}) {
+      run("predictBlock/hs",
+          "labels=" + std::to_string(nlabels) + " dim=64 k=" + std::to_string(k),
+          nb, 0, [&]() {
+        model.predictBlock(hiddens, nb, k, 0.0, heaps.data(), nullptr);
+        sink = heaps[0][0].first;
+      });
+    }
+  }
+}
+
+static void benchUpdate() {
+  std::mt19937_64 rng(0);
+  const int32_t k = 10, dim = 64, nlabels = 1000;
+  const std::pair<loss_name, std::string> losses[] = {
+    {loss_name::softmax, "softmax"},
+    {loss_name::ns, "ns"},
+    {loss_name::hs, "hs"}};
+  for (auto& loss : losses) {
+    auto args = supervisedArgs(k, dim);
+    args->loss = loss.first;
+    Dictionary dict(args);
+    auto wi = std::make_shared<Matrix>(dict.nwords(), dim);
+    auto wo = std::make_shared<Matrix>(nlabels, dim);
+    wi->uniform(1.0 / dim);
+    wo->zero();
+    Model model(wi, wo, args, 0);
+    std::vector<int64_t> counts(nlabels);
+    for (auto& c : counts) {
+      c = 1 + rng() % 1000;
+    }
+    model.setTargetCounts(counts);
+    std::vector<std::vector<fasttext::index>> reads(256);
+    std::vector<int32_t> targets;
+    for (auto& words : reads) {
+      std::string read = randomSequence(rng, 150);
+      dict.readSequence(read, words);
+      targets.push_back(rng() % nlabels);
+    }
+    run("update", "loss=" + loss.second + " labels=1000 dim=64",
+        reads.size(), 0, [&]() {
+      for (size_t i = 0; i < reads.size(); i++) {
+        model.update(reads[i], targets[i], 0.05);
+      }
+      sink = model.getLoss();
+    });
+  }
+}
+
+static void benchProductQuantizer() {
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<real> uniform(-1, 1);
+  const int32_t dim = 64, dsub = 2, n = 16384;
+  std::vector<real> x(int64_t(n) * dim);
+  for (auto& v : x) {
+    v = uniform(rng);
+  }
+  ProductQuantizer pq(dim, dsub);
+  // kmeans of one sub-quantizer, on contiguous sub-vectors
+  const int32_t ksub = 256, np = 64 * ksub;
+  std::vector<real> xs(x.begin(), x.begin() + int64_t(np) * dsub);
+  std::vector<real> centroids(ksub * dsub);
+  run("pq/kmeans", "n=16384 dsub=2 ksub=256", 1,
+      double(np) * dsub * sizeof(real), [&]() {
+    pq.kmeans(xs.data(), centroids.data(), np, dsub);
+    sink = centroids[0];
+  });
+  // the codebooks are trained on a subset to keep the setup short
+  pq.train(ksub * 8, x.data());
+  std::vector<uint8_t> codes(int64_t(n) * dim / dsub);
+  run("pq/compute_codes", "dim=64 dsub=2", n, dim * sizeof(real), [&]() {
+    pq.compute_codes(x.data(), codes.data(), n);
+    sink = codes[0];
+  });
+}
+
+static void writeFasta(const std::string& dir, std::mt19937_64& rng) {
+  std::ofstream fasta(dir + "/train.fasta");
+  std::ofstream labels(dir + "/train.labels");
+  for (int32_t i = 0; i < 10; i++) {
+    std::string seq = randomSequence(rng, 100000);
+    fasta << ">genome" << i << "\n";
+    for (size_t j = 0; j < seq.size(); j += 80) {
+      fasta << seq.substr(j, 80) << "\n";
+    }
+    labels << "label" << i << "\n";
+  }
+}
+
+static void benchLoadSave() {
+  std::mt19937_64 rng(0);
+  char tmpl[] = "/tmp/fastdna-bench-XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    std::cerr << "Cannot create a temporary directory" << std::endl;
+    return;
+  }
+  const std::string dir(tmpl);
+  writeFasta(dir, rng);
+  Args args = *supervisedArgs(10, 64);
+  args.input = dir + "/train.fasta";
+  args.labels = dir + "/train.labels";
+  args.output = dir + "/model";
+  args.epoch = 1;
+  args.thread = 1;
+  args.length = 150;
+  FastText fasttext;
+  fasttext.train(args);
+  const std::string path = dir + "/model.bin";
+  fasttext.saveModel(path);
+  std::ifstream ifs(path, std::ifstream::binary | std::ifstream::ate);
+  const double bytes = ifs.tellg();
+  ifs.close();
+  run("saveModel", "k=10 dim=64", 1, bytes, [&]() {
+    fasttext.saveModel(path);
+  });
+  run("loadModel", "k=10 dim=64", 1, bytes, [&]() {
+    FastText loaded;
+    loaded.loadModel(path);
+    sink = loaded.getDimension();
+  });
+  unlink(path.c_str());
+  unlink(args.input.c_str());
+  unlink(args.labels.c_str());
+  rmdir(dir.c_str());
+}
+
+static void printUsage() {
+  std::cerr
+    << "usage: fastdna-bench [-format csv|json] [-time <seconds>] [-filter <name>]\n\n"
+    << "  -format   output format on stdout [csv]\n"
+    << "  -time     minimum running time of each benchmark [0.5]\n"
+    << "  -filter   only run benchmarks whose name contains this string\n"
+    << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string format = "csv";
+  for (int i = 1; i < argc; i += 2) {
+    std::string arg(argv[i]);
+    if (i + 1 >= argc) {
+      printUsage();
+      exit(EXIT_FAILURE);
+    }
+    if (arg == "-format") {
+      format = argv[i + 1];
+    } else if (arg == "-time") {
+      minTime = atof(argv[i + 1]);
+    } else if (arg == "-filter") {
+      filter = argv[i + 1];
+    } else {
+      printUsage();
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (format != "csv" && format != "json") {
+    printUsage();
+    exit(EXIT_FAILURE);
+  }
+
+  if (enabled("readSequence")) benchReadSequence();
+  if (enabled("computeIndex")) benchComputeIndex();
+  if (enabled("computeHidden")) benchComputeHidden();
+  if (enabled("computeOutputSoftmax")) benchComputeOutputSoftmax();
+  if (enabled("predictBlock")) benchPredictHs();
+  if (enabled("update")) benchUpdate();
+  if (enabled("pq")) benchProductQuantizer();
+  if (enabled("loadModel") || enabled("saveModel")) benchLoadSave();
+
+  std::cout << std::setprecision(6);
+  if (format == "csv") {
+    std::cout << "benchmark,params,ops,ns_per_op,gb_per_s" << std::endl;
+  }
+  for (auto& r : results) {
+    if (format == "csv") {
+      std::cout << r.name << "," << r.params << "," << r.ops << ","
+                << r.nsPerOp << "," << r.gbPerSec << std::endl;
+    } else {
+      std::cout << "{\"benchmark\": \"" << r.name << "\", \"params\": \""
+                << r.params << "\", \"ops\": " << r.ops
+                << ", \"ns_per_op\": " << r.nsPerOp
+                << ", \"gb_per_s\": " << r.gbPerSec << "}" << std::endl;
+    }
+  }
+  return 0;
+}
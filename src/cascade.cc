@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "cascade.h"
+
+#include <istream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "prefetcher.h"
+
+namespace fasttext {
+
+Cascade::State::State(const Cascade& cascade)
+  : hidden(cascade.coarse_->getArgs().dim),
+    output(cascade.coarse_->getDictionary()->nlabels()) {}
+
+Cascade::Cascade(std::shared_ptr<const FastText> coarse,
+                 const Taxonomy& taxonomy,
+                 const Dictionary& fine,
+                 int32_t shortlist)
+  : coarse_(coarse), nlabels_(fine.nlabels()), shortlist_(shortlist),
+    reads_(0), shortlisted_(0) {
+  if (shortlist <= 0) {
+    throw std::invalid_argument("The shortlist needs at least one group!");
+  }
+  auto groups = coarse_->getDictionary();
+  std::unordered_map<std::string, int32_t> ids;
+  for (int32_t g = 0; g < groups->nlabels(); g++) {
+    ids[groups->getLabel(g)] = g;
+  }
+  // the rank of the groups has the most classes among the coarse labels
+  int32_t rank = -1, best = 0;
+  for (int32_t r = 0; r < taxonomy.nranks(); r++) {
+    int32_t found = 0;
+    for (auto& name : taxonomy.names(r)) {
+      found += ids.count(name);
+    }
+    if (found > best) {
+      rank = r;
+      best = found;
+    }
+  }
+  if (rank < 0) {
+    throw std::invalid_argument(
+        "No rank of the taxonomy has labels of the coarse model!");
+  }
+  members_.resize(groups->nlabels());
+  const std::vector<std::string>& names = taxonomy.names(rank);
+  for (int32_t l = 0; l < nlabels_; l++) {
+    const int32_t c = taxonomy.ancestor(rank, l);
+    auto it = c < 0 ? ids.end() : ids.find(names[c]);
+    if (it == ids.end()) {
+      ungrouped_.push_back(l);
+    } else {
+      members_[it->second].push_back(l);
+    }
+  }
+}
+
+void Cascade::tokenize(std::string& read, std::vector<index>& words) const {
+  MemoryBuffer mb(&read[0], read.size());
+  std::istream is(&mb);
+  coarse_->getDictionary()->readSequence(is, words, -1);
+}
+
+// Fine labels of the best groups of a read, pooled with its mate if any
+void Cascade::shortlist(std::string& read,
+                        std::string* mate,
+                        State& state,
+                        std::vector<int32_t>& labels) {
+  tokenize(read, state.words);
+  if (mate) {
+    tokenize(*mate, state.mateWords);
+    state.words.insert(state.words.end(), state.mateWords.begin(),
+                       state.mateWords.end());
+  }
+  labels.clear();
+  state.groups.clear();
+  if (!state.words.empty()) {
+    coarse_->getModel()->predict(state.words, shortlist_, 0.0, state.groups,
+                                 state.hidden, state.output);
+  }
+  if (state.groups.empty()) {
+    for (int32_t l = 0; l < nlabels_; l++) {
+      labels.push_back(l);
+    }
+  } else {
+    for (auto it = state.groups.cbegin(); it != state.groups.cend(); ++it) {
+      const std::vector<int32_t>& members = members_[it->second];
+      labels.insert(labels.end(), members.begin(), members.end());
+    }
+    labels.insert(labels.end(), ungrouped_.begin(), ungrouped_.end());
+  }
+  reads_++;
+  shortlisted_ += labels.size();
+}
+
+int32_t Cascade::nlabels() const {
+  return nlabels_;
+}
+
+int64_t Cascade::reads() const {
+  return reads_;
+}
+
+int64_t Cascade::shortlisted() const {
+  return shortlisted_;
+}
+
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dictionary.h"
+#include "evaluator.h"
+#include "fasttext.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+/*
+Cascade
+A coarse model, trained on groups of the labels of a fine model (the
+genera of its species, for instance), shortlists the labels of the fine
+model: the softmax of the fine model is only computed over the labels of
+the best groups of a read, plus the labels of no group, instead of over
+all its labels. The group of every fine label is its ancestor, in a
+taxonomy file, at the rank whose classes are the labels of the coarse
+model.
+
+A read without groups, when the coarse model has no k-mers of it, is
+scored over all labels.
+*/
+class Cascade {
+ protected:
+  std::shared_ptr<const FastText> coarse_;
+  int32_t nlabels_;
+  int32_t shortlist_;
+  // members_[g] are the fine labels of coarse label g
+  std::vector<std::vector<int32_t>> members_;
+  std::vector<int32_t> ungrouped_;
+  std::atomic<int64_t> reads_;
+  std::atomic<int64_t> shortlisted_;
+
+  void tokenize(std::string&, std::vector<index>&) const;
+
+ public:
+  // Buffers of a classification thread
+  struct State {
+    std::vector<index> words;
+    std::vector<index> mateWords;
+    Vector hidden;
+    Vector output;
+    std::vector<std::pair<real, int32_t>> groups;
+
+    explicit State(const Cascade&);
+  };
+
+  Cascade(std::shared_ptr<const FastText>, const Taxonomy&,
+          const Dictionary&, int32_t);
+
+  void shortlist(std::string&, std::string*, State&, std::vector<int32_t>&);
+  int32_t nlabels() const;
+  int64_t reads() const;
+  int64_t shortlisted() const;
+};
+
+}
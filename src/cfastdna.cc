@@ -0,0 +1,297 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "cfastdna.h"
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fasttext.h"
+
+using namespace fasttext;
+
+struct fdna_model {
+  std::shared_ptr<const FastText> fasttext;
+  std::vector<std::string> labels;
+};
+
+struct fdna_session {
+  const fdna_model* model;
+  std::string sequence;
+  std::vector<fasttext::index> words, mateWords;
+  std::unique_ptr<Vector> hidden, hidden2, output, output2;
+  std::unique_ptr<Matrix> hiddens;
+  std::vector<std::vector<std::pair<real, int32_t>>> heaps;
+  std::vector<int32_t> rows;
+};
+
+// sequences are scored by blocks of this many rows
+static const int32_t BLOCK_SIZE = 64;
+
+static thread_local std::string last_error;
+
+static void setError(const std::string& error) {
+  last_error = error;
+}
+
+int fdna_api_version(void) {
+  return FDNA_API_VERSION;
+}
+
+const char* fdna_last_error(void) {
+  return last_error.c_str();
+}
+
+fdna_model* fdna_load_model(const char* path) {
+  if (path == nullptr) {
+    setError("No model path given");
+    return nullptr;
+  }
+  try {
+    std::unique_ptr<fdna_model> model(new fdna_model());
+    auto fasttext = std::make_shared<FastText>();
+    fasttext->loadModel(std::string(path));
+    if (fasttext->getArgs().model != model_name::sup) {
+      setError(std::string(path) + " is not a supervised model");
+      return nullptr;
+    }
+    auto dict = fasttext->getDictionary();
+    for (int32_t i = 0; i < dict->nlabels(); i++) {
+      model->labels.push_back(dict->getLabel(i));
+    }
+    model->fasttext = fasttext;
+    return model.release();
+  } catch (const std::exception& e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+void fdna_free_model(fdna_model* model) {
+  delete model;
+}
+
+int32_t fdna_dimension(const fdna_model* model) {
+  if (model == nullptr) {
+    setError("No model given");
+    return -1;
+  }
+  return model->fasttext->getDimension();
+}
+
+int32_t fdna_nlabels(const fdna_model* model) {
+  if (model == nullptr) {
+    setError("No model given");
+    return -1;
+  }
+  return model->labels.size();
+}
+
+const char* fdna_label(const fdna_model* model, int32_t i) {
+  if (model == nullptr) {
+    setError("No model given");
+    return nullptr;
+  }
+  if (i < 0 || i >= model->labels.size()) {
+    setError("Label id is out of range");
+    return nullptr;
+  }
+  return model->labels[i].c_str();
+}
+
+fdna_session* fdna_new_session(const fdna_model* model) {
+  if (model == nullptr) {
+    setError("No model given");
+    return nullptr;
+  }
+  try {
+    fdna_session* session = new fdna_session();
+    const int32_t dim = model->fasttext->getDimension();
+    session->model = model;
+    const int32_t nlabels = model->labels.size();
+    session->hidden.reset(new Vector(dim));
+    session->hidden2.reset(new Vector(dim));
+    session->output.reset(new Vector(nlabels));
+    session->output2.reset(new Vector(nlabels));
+    session->hiddens.reset(new Matrix(BLOCK_SIZE, dim));
+    session->heaps.resize(BLOCK_SIZE);
+    return session;
+  } catch (const std::exception& e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+void fdna_free_session(fdna_session* session) {
+  delete session;
+}
+
+// Reads the k-mers of sequence i into words, returns false if it has none
+static bool readWords(fdna_session* session,
+                      const char* const* sequences,
+                      int32_t i,
+                      std::vector<fasttext::index>& words) {
+  words.clear();
+  if (sequences == nullptr || sequences[i] == nullptr) {
+    return false;
+  }
+  session->sequence.assign(sequences[i]);
+  session->model->fasttext->getDictionary()->readSequence(
+      session->sequence, words);
+  return !words.empty();
+}
+
+// Writes the predictions of heap to row i of labels and probs
+static void writeRow(const std::vector<std::pair<real, int32_t>>& heap,
+                     int64_t offset,
+                     int32_t* labels,
+                     float* probs) {
+  for (size_t j = 0; j < heap.size(); j++) {
+    labels[offset + j] = heap[j].second;
+    probs[offset + j] = std::exp(heap[j].first);
+  }
+}
+
+// Classifies the sequences, or the pairs if mates is given, the way
+// FastText::classify does: pairs by the union of their k-mers, or by the
+// average of the posteriors of both mates if average is set
+static int classify(fdna_session* session,
+                    const char* const* sequences,
+                    const char* const* mates,
+                    int32_t n,
+                    int32_t k,
+                    float threshold,
+                    bool average,
+                    int32_t* labels,
+                    float* probs) {
+  auto model = session->model->fasttext->getModel();
+  const int32_t dim = session->model->fasttext->getDimension();
+  Matrix& hiddens = *session->hiddens;
+  Vector& hidden = *session->hidden;
+  auto& words = session->words;
+  auto& mateWords = session->mateWords;
+  std::fill(labels, labels + int64_t(n) * k, -1);
+  std::fill(probs, probs + int64_t(n) * k, 0.0);
+  int found = 0;
+  for (int32_t i0 = 0; i0 < n; i0 += BLOCK_SIZE) {
+    const int32_t i1 = std::min(n, i0 + BLOCK_SIZE);
+    session->rows.clear();
+    for (int32_t i = i0; i < i1; i++) {
+      const bool hasWords = readWords(session, sequences, i, words);
+      const bool hasMateWords = readWords(session, mates, i, mateWords);
+      if (!hasWords && !hasMateWords) {
+        continue;
+      }
+      if (average && hasWords && hasMateWords) {
+        auto& heap = session->heaps[0];
+        model->predict_paired(words, mateWords, k, threshold, heap, hidden,
+                              *session->hidden2, *session->output,
+                              *session->output2);
+        writeRow(heap, int64_t(i) * k, labels, probs);
+        found++;
+        continue;
+      }
+      words.insert(words.end(), mateWords.begin(), mateWords.end());
+      model->computeHidden(words, hidden);
+      std::copy(hidden.data(), hidden.data() + dim,
+                hiddens.data() + session->rows.size() * dim);
+      session->rows.push_back(i);
+    }
+    if (session->rows.empty()) {
+      continue;
+    }
+    model->predictBlock(hiddens, session->rows.size(), k, threshold,
+                        session->heaps.data(), nullptr);
+    for (size_t r = 0; r < session->rows.size(); r++) {
+      writeRow(session->heaps[r], int64_t(session->rows[r]) * k, labels,
+               probs);
+    }
+    found += session->rows.size();
+  }
+  return found;
+}
+
+int fdna_classify(fdna_session* session,
+                  const char* const* sequences,
+                  int32_t n,
+                  int32_t k,
+                  float threshold,
+                  int32_t* labels,
+                  float* probs) {
+  if (session == nullptr || sequences == nullptr || labels == nullptr ||
+      probs == nullptr || n < 0 || k <= 0) {
+    setError("Invalid arguments to fdna_classify");
+    return -1;
+  }
+  try {
+    return classify(session, sequences, nullptr, n, k, threshold, false,
+                    labels, probs);
+  } catch (const std::exception& e) {
+    setError(e.what());
+    return -1;
+  }
+}
+
+int fdna_classify_paired(fdna_session* session,
+                         const char* const* sequences,
+                         const char* const* mates,
+                         int32_t n,
+                         int32_t k,
+                         float threshold,
+                         int average,
+                         int32_t* labels,
+                         float* probs) {
+  if (session == nullptr || sequences == nullptr || mates == nullptr ||
+      labels == nullptr || probs == nullptr || n < 0 || k <= 0) {
+    setError("Invalid arguments to fdna_classify_paired");
+    return -1;
+  }
+  try {
+    return classify(session, sequences, mates, n, k, threshold, average != 0,
+                    labels, probs);
+  } catch (const std::exception& e) {
+    setError(e.what());
+    return -1;
+  }
+}
+
+int fdna_embed(fdna_session* session,
+               const char* const* sequences,
+               int32_t n,
+               float* embeddings) {
+  if (session == nullptr || sequences == nullptr || embeddings == nullptr ||
+      n < 0) {
+    setError("Invalid arguments to fdna_embed");
+    return -1;
+  }
+  try {
+    auto model = session->model->fasttext->getModel();
+    const int32_t dim = session->model->fasttext->getDimension();
+    Vector& hidden = *session->hidden;
+    int found = 0;
+    for (int32_t i = 0; i < n; i++) {
+      float* out = embeddings + int64_t(i) * dim;
+      if (!readWords(session, sequences, i, session->words)) {
+        std::fill(out, out + dim, 0.0);
+        continue;
+      }
+      model->computeHidden(session->words, hidden);
+      std::copy(hidden.data(), hidden.data() + dim, out);
+      found++;
+    }
+    return found;
+  } catch (const std::exception& e) {
+    setError(e.what());
+    return -1;
+  }
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+/*
+C API of libfastdna.so
+A model is loaded once and shared, read-only, by any number of sessions.
+Each session owns its scratch buffers, so different sessions can classify
+concurrently from different threads; a single session must not be used by
+two threads at the same time.
+
+Functions returning a pointer return NULL on failure, functions returning
+an int return a negative value on failure; fdna_last_error() then
+describes the error of the calling thread.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FDNA_API_VERSION 2
+
+typedef struct fdna_model fdna_model;
+typedef struct fdna_session fdna_session;
+
+int fdna_api_version(void);
+const char* fdna_last_error(void);
+
+fdna_model* fdna_load_model(const char* path);
+void fdna_free_model(fdna_model* model);
+int32_t fdna_dimension(const fdna_model* model);
+int32_t fdna_nlabels(const fdna_model* model);
+/* Name of label i, owned by the model */
+const char* fdna_label(const fdna_model* model, int32_t i);
+
+fdna_session* fdna_new_session(const fdna_model* model);
+void fdna_free_session(fdna_session* session);
+
+/*
+Classifies n nucleotide sequences (without FASTA header, NUL-terminated).
+labels and probs hold n * k values: the k most likely labels of each
+sequence, in decreasing order of probability. Unused slots are filled
+with label -1 and probability 0. Returns the number of sequences that
+had at least one k-mer.
+*/
+int fdna_classify(fdna_session* session,
+                  const char* const* sequences,
+                  int32_t n,
+                  int32_t k,
+                  float threshold,
+                  int32_t* labels,
+                  float* probs);
+
+/*
+Classifies n paired-end reads, sequences[i] and mates[i] being the two
+mates of pair i, like fdna_classify: by the union of the k-mers of both
+mates, or by the average of their posteriors if average is nonzero. A pair
+with one mate without k-mers is classified by the other mate. Returns the
+number of pairs that had at least one k-mer.
+*/
+int fdna_classify_paired(fdna_session* session,
+                         const char* const* sequences,
+                         const char* const* mates,
+                         int32_t n,
+                         int32_t k,
+                         float threshold,
+                         int average,
+                         int32_t* labels,
+                         float* probs);
+
+/*
+Writes the hidden vector (mean k-mer embedding) of each of the n
+sequences into embeddings, which holds n * fdna_dimension() values.
+Returns the number of sequences that had at least one k-mer.
+*/
+int fdna_embed(fdna_session* session,
+               const char* const* sequences,
+               int32_t n,
+               float* embeddings);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,341 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "coordinator.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "server.h"
+#include "utils.h"
+
+namespace fasttext {
+
+static const int32_t COORDINATOR_MAGIC = 0x66444e41;
+
+// Shape and checksum of the parameters of a worker
+struct Hello {
+  int32_t magic;
+  int64_t inRows;
+  int64_t outRows;
+  int64_t dim;
+  uint64_t checksum;
+};
+
+static void sendAll(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("Connection lost: " + std::string(strerror(errno)));
+    }
+    p += n;
+    size -= n;
+  }
+}
+
+static void receiveAll(int fd, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("Connection lost: " +
+          std::string(n == 0 ? "closed by peer" : strerror(errno)));
+    }
+    p += n;
+    size -= n;
+  }
+}
+
+static uint64_t checksum(const Matrix& in, const Matrix& out) {
+  uint64_t h = 0;
+  for (const Matrix* m : {&in, &out}) {
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(m->data());
+    const int64_t n = m->size(0) * m->size(1);
+    for (int64_t i = 0; i < n; i++) {
+      h = utils::mix64(h ^ words[i]);
+    }
+  }
+  return h;
+}
+
+Coordinator::Coordinator(int32_t nworkers) : nworkers_(nworkers) {
+  if (nworkers_ <= 0) {
+    throw std::invalid_argument("The coordinator needs at least one worker!");
+  }
+}
+
+void Coordinator::serve(const std::string& address) {
+  int listener = Server::listen(address);
+  std::cerr << "Waiting for " << nworkers_ << " worker(s) on " << address << std::endl;
+  std::vector<int> fds;
+  std::vector<Hello> hellos(nworkers_);
+  while (fds.size() < size_t(nworkers_)) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      ::close(listener);
+      throw std::runtime_error("Cannot accept workers: " + std::string(strerror(errno)));
+    }
+    receiveAll(fd, &hellos[fds.size()], sizeof(Hello));
+    fds.push_back(fd);
+  }
+  ::close(listener);
+
+  // ranks follow the order of connection
+  const Hello& first = hellos[0];
+  bool same = true;
+  for (const Hello& hello : hellos) {
+    same = same && hello.magic == COORDINATOR_MAGIC &&
+      hello.inRows == first.inRows && hello.outRows == first.outRows &&
+      hello.dim == first.dim && hello.checksum == first.checksum;
+  }
+  for (int32_t w = 0; w < nworkers_; w++) {
+    int32_t header[2] = {same ? w : -1, nworkers_};
+    sendAll(fds[w], header, sizeof(header));
+  }
+  if (!same) {
+    for (int fd : fds) {
+      ::close(fd);
+    }
+    throw std::invalid_argument("Workers do not train the same initial model!");
+  }
+
+  const int64_t dim = first.dim;
+  Matrix input(first.inRows, dim);
+  Matrix output(first.outRows, dim);
+  receiveAll(fds[0], input.data(), input.size(0) * dim * sizeof(real));
+  receiveAll(fds[0], output.data(), output.size(0) * dim * sizeof(real));
+  std::cerr << "Training with " << nworkers_ << " worker(s)" << std::endl;
+
+  // lastChanged[r] is the last round in which input row r changed
+  std::vector<int32_t> lastChanged(input.size(0), -1);
+  std::vector<int32_t> doneRound(nworkers_, -1);
+  std::unordered_map<index, size_t> base;
+  std::vector<index> rows, workerRows;
+  std::vector<real> bases, values, workerOutput;
+  std::vector<real> outputBase(output.size(0) * dim);
+  int32_t active = nworkers_;
+  int32_t round = 0;
+  int64_t totalRows = 0;
+  for (; active > 0; round++) {
+    base.clear();
+    rows.clear();
+    bases.clear();
+    std::copy(output.data(), output.data() + outputBase.size(), outputBase.begin());
+    std::vector<int32_t> finished;
+    for (int32_t w = 0; w < nworkers_; w++) {
+      if (doneRound[w] >= 0) {
+        continue;
+      }
+      int32_t done;
+      int64_t n;
+      receiveAll(fds[w], &done, sizeof(done));
+      receiveAll(fds[w], &n, sizeof(n));
+      workerRows.resize(n);
+      values.resize(n * dim);
+      workerOutput.resize(outputBase.size());
+      receiveAll(fds[w], workerRows.data(), n * sizeof(index));
+      receiveAll(fds[w], values.data(), n * dim * sizeof(real));
+      receiveAll(fds[w], workerOutput.data(), workerOutput.size() * sizeof(real));
+      // the change of a worker is relative to the rows at the start of the round
+      for (int64_t i = 0; i < n; i++) {
+        const index r = workerRows[i];
+        if (r >= input.size(0)) {
+          throw std::runtime_error("Worker " + std::to_string(w) + " sent an invalid row");
+        }
+        real* row = input.data() + r * dim;
+        auto it = base.find(r);
+        if (it == base.end()) {
+          it = base.emplace(r, bases.size()).first;
+          bases.insert(bases.end(), row, row + dim);
+          rows.push_back(r);
+          lastChanged[r] = round;
+        }
+        const real* before = bases.data() + it->second;
+        const real* after = values.data() + i * dim;
+        for (int64_t j = 0; j < dim; j++) {
+          row[j] += after[j] - before[j];
+        }
+      }
+      for (size_t j = 0; j < outputBase.size(); j++) {
+        output.data()[j] += workerOutput[j] - outputBase[j];
+      }
+      if (done) {
+        doneRound[w] = round;
+        active--;
+      }
+    }
+    totalRows += rows.size();
+
+    values.resize(rows.size() * dim);
+    for (size_t i = 0; i < rows.size(); i++) {
+      std::copy(input.data() + rows[i] * dim, input.data() + (rows[i] + 1) * dim,
+                values.data() + i * dim);
+    }
+    const int64_t n = rows.size();
+    for (int32_t w = 0; w < nworkers_; w++) {
+      if (doneRound[w] >= 0) {
+        continue;
+      }
+      sendAll(fds[w], &n, sizeof(n));
+      sendAll(fds[w], rows.data(), n * sizeof(index));
+      sendAll(fds[w], values.data(), n * dim * sizeof(real));
+      sendAll(fds[w], output.data(), output.size(0) * dim * sizeof(real));
+    }
+  }
+
+  // finished workers catch up with the rounds of the others
+  for (int32_t w = 0; w < nworkers_; w++) {
+    rows.clear();
+    for (int64_t r = 0; r < input.size(0); r++) {
+      if (lastChanged[r] >= doneRound[w]) {
+        rows.push_back(r);
+      }
+    }
+    values.resize(rows.size() * dim);
+    for (size_t i = 0; i < rows.size(); i++) {
+      std::copy(input.data() + rows[i] * dim, input.data() + (rows[i] + 1) * dim,
+                values.data() + i * dim);
+    }
+    const int64_t n = rows.size();
+    sendAll(fds[w], &n, sizeof(n));
+    sendAll(fds[w], rows.data(), n * sizeof(index));
+    sendAll(fds[w], values.data(), n * dim * sizeof(real));
+    sendAll(fds[w], output.data(), output.size(0) * dim * sizeof(real));
+    ::close(fds[w]);
+  }
+  std::cerr << "Merged " << round << " round(s), "
+            << (round > 0 ? totalRows / round : 0) << " input rows per round"
+            << std::endl;
+}
+
+CoordinatorClient::CoordinatorClient()
+  : fd_(-1), rank_(0), nworkers_(1), bytesSent_(0), bytesReceived_(0) {}
+
+CoordinatorClient::~CoordinatorClient() {
+  close();
+}
+
+void CoordinatorClient::send(const void* data, size_t size) {
+  sendAll(fd_, data, size);
+  bytesSent_ += size;
+}
+
+void CoordinatorClient::receive(void* data, size_t size) {
+  receiveAll(fd_, data, size);
+  bytesReceived_ += size;
+}
+
+void CoordinatorClient::connect(const std::string& address,
+                                const Matrix& input,
+                                const Matrix& output) {
+  fd_ = Server::connect(address);
+  Hello hello;
+  memset(&hello, 0, sizeof(hello));
+  hello.magic = COORDINATOR_MAGIC;
+  hello.inRows = input.size(0);
+  hello.outRows = output.size(0);
+  hello.dim = input.size(1);
+  hello.checksum = checksum(input, output);
+  send(&hello, sizeof(hello));
+  int32_t header[2];
+  receive(header, sizeof(header));
+  if (header[0] < 0) {
+    throw std::invalid_argument("Workers do not train the same initial model!");
+  }
+  rank_ = header[0];
+  nworkers_ = header[1];
+  if (rank_ == 0) {
+    send(input.data(), input.size(0) * input.size(1) * sizeof(real));
+    send(output.data(), output.size(0) * output.size(1) * sizeof(real));
+  }
+}
+
+// Sends the touched input rows and the output matrix, and replaces them by
+// the merged parameters. The last sync blocks until all workers are done.
+void CoordinatorClient::sync(Matrix& input,
+                             Matrix& output,
+                             std::vector<uint8_t>& touched,
+                             bool done) {
+  const int64_t dim = input.size(1);
+  std::vector<index> rows;
+  for (size_t r = 0; r < touched.size(); r++) {
+    if (touched[r]) {
+      rows.push_back(r);
+      touched[r] = 0;
+    }
+  }
+  std::vector<real> values(rows.size() * dim);
+  for (size_t i = 0; i < rows.size(); i++) {
+    std::copy(input.data() + rows[i] * dim, input.data() + (rows[i] + 1) * dim,
+              values.data() + i * dim);
+  }
+  int32_t last = done;
+  int64_t n = rows.size();
+  send(&last, sizeof(last));
+  send(&n, sizeof(n));
+  send(rows.data(), n * sizeof(index));
+  send(values.data(), n * dim * sizeof(real));
+  send(output.data(), output.size(0) * dim * sizeof(real));
+
+  receive(&n, sizeof(n));
+  rows.resize(n);
+  values.resize(n * dim);
+  receive(rows.data(), n * sizeof(index));
+  receive(values.data(), n * dim * sizeof(real));
+  receive(output.data(), output.size(0) * dim * sizeof(real));
+  for (int64_t i = 0; i < n; i++) {
+    if (rows[i] >= input.size(0)) {
+      throw std::runtime_error("The coordinator sent an invalid row");
+    }
+    std::copy(values.data() + i * dim, values.data() + (i + 1) * dim,
+              input.data() + rows[i] * dim);
+  }
+}
+
+void CoordinatorClient::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+int32_t CoordinatorClient::rank() const {
+  return rank_;
+}
+
+int32_t CoordinatorClient::nworkers() const {
+  return nworkers_;
+}
+
+int64_t CoordinatorClient::bytesSent() const {
+  return bytesSent_;
+}
+
+int64_t CoordinatorClient::bytesReceived() const {
+  return bytesReceived_;
+}
+
+}
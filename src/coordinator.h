@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+#include "real.h"
+
+namespace fasttext {
+
+/*
+Data-parallel training
+Several worker processes train the same model, each with its own share of
+the fragments and its own sampler seeds, and periodically merge their
+parameters through a coordinator over a Unix domain socket, or localhost
+TCP if the address is a port number.
+
+The coordinator keeps the reference parameters. On connection, workers
+send the shape and a checksum of their initial parameters, which must all
+be identical, and receive their rank; rank 0 then uploads its parameters.
+At every round, each worker sends the input rows it touched since the
+last round and its whole output matrix; the coordinator adds the change
+of every worker to the reference rows, and replies with the new values
+of all the rows touched by any worker in that round, so that all workers
+start the next round with the reference parameters.
+
+A worker that sends its last round gets its reply once all the workers
+are done, with every row changed since that round.
+*/
+class Coordinator {
+ protected:
+  int32_t nworkers_;
+
+ public:
+  explicit Coordinator(int32_t);
+
+  void serve(const std::string&);
+};
+
+// Connection of a worker to the coordinator
+class CoordinatorClient {
+ protected:
+  int fd_;
+  int32_t rank_;
+  int32_t nworkers_;
+  int64_t bytesSent_;
+  int64_t bytesReceived_;
+
+  void send(const void*, size_t);
+  void receive(void*, size_t);
+
+ public:
+  CoordinatorClient();
+  ~CoordinatorClient();
+
+  void connect(const std::string&, const Matrix&, const Matrix&);
+  void sync(Matrix&, Matrix&, std::vector<uint8_t>&, bool);
+  void close();
+
+  int32_t rank() const;
+  int32_t nworkers() const;
+  int64_t bytesSent() const;
+  int64_t bytesReceived() const;
+};
+
+}
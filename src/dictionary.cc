@@ -25,14 +25,44 @@ namespace fasttext {
 
 const char Dictionary::BOS = '>';
 
+// mask of the last k bases of a 2-bit code, k <= 32
+static inline uint64_t kmerMask(int k) {
+  return k == 32 ? ~uint64_t(0) : (uint64_t(1) << 2*k) - 1;
+}
+
 Dictionary::Dictionary(std::shared_ptr<Args> args) : args_(args),
-  nlabels_(0), nsequences_(0), pruneidx_size_(-1) {}
+  nlabels_(0), nsequences_(0), pruneidx_size_(-1) {
+  initKmers();
+}
 
 Dictionary::Dictionary(std::shared_ptr<Args> args, std::istream& in) : args_(args),
   nsequences_(0), nlabels_(0), pruneidx_size_(-1) {
+  initKmers();
   load(in);
 }
 
+/*
+Multi-k layout of the input matrix
+When maxn > minn, k-mers of every length from minn to maxn are read
+in a single pass. Lengths up to denseK get their own dense table, laid
+out one after the other; longer ones are hashed into args_->bucket
+shared rows after the last dense table.
+
+  [ dense minn | dense minn+1 | ... | dense denseK | buckets ]
+*/
+void Dictionary::initKmers() {
+  kmin_ = args_->minn;
+  kmax_ = std::max(args_->minn, args_->maxn);
+  offsets_.assign(kmax_ + 1, 0);
+  ndense_ = 0;
+  for (int8_t k = kmin_; k <= kmax_; k++) {
+    offsets_[k] = ndense_;
+    if (!isHashed(k)) {
+      ndense_ += nwords(k);
+    }
+  }
+}
+
 /*
 Indexing schema for k-mers
 A k-mer is attributed to one of the 10 subparts
@@ -103,6 +133,26 @@ int Dictionary::labelFromPos(const std::streampos& pos) {
   return index;
 }
 
+int32_t Dictionary::nsequences() const {
+  return nsequences_;
+}
+
+const entry& Dictionary::getEntry(int32_t i) const {
+  return sequences_.at(i);
+}
+
+// Returns the label index of sequence i
+int32_t Dictionary::getLabelId(int32_t i) const {
+  return label2int_.at(sequences_.at(i).label);
+}
+
+// Returns the last sequence whose header starts at or before pos
+int32_t Dictionary::sequenceFromPos(int64_t pos) const {
+  auto it = std::upper_bound(sequences_.cbegin(), sequences_.cend(), pos,
+    [](int64_t p, const entry& e) { return p < int64_t(e.name_pos); });
+  return std::max<int32_t>(0, int32_t(it - sequences_.cbegin()) - 1);
+}
+
 void Dictionary::addLabel(const entry e) {
   auto it = label2int_.find(e.label);
   if (it == label2int_.end()) {
@@ -123,7 +173,7 @@ index Dictionary::nwords(const int8_t k) const {
 }
 
 index Dictionary::nwords() const {
-  return nwords(args_->minn);
+  return ndense_;
 }
 
 int32_t Dictionary::nlabels() const {
@@ -150,6 +200,29 @@ uint32_t Dictionary::hash(const std::string& str) const {
   return h;
 }
 
+bool Dictionary::isHashed(const int8_t k) const {
+  return kmax_ > kmin_ && k > args_->denseK;
+}
+
+uint64_t Dictionary::hashCanonical(uint64_t kmer,
+                                   uint64_t kmer_reverse,
+                                   const int8_t k) const {
+  // 64-bit finalizer from MurmurHash3 on the canonical k-mer, salted with k
+  uint64_t h = std::min(kmer, kmer_reverse) ^ (0x9e3779b97f4a7c15ULL * k);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+index Dictionary::hashKmer(uint64_t kmer,
+                           uint64_t kmer_reverse,
+                           const int8_t k) const {
+  return ndense_ + hashCanonical(kmer, kmer_reverse, k) % args_->bucket;
+}
+
 int8_t Dictionary::base2int(const char c) const {
   // With this convention, the complementary basepair is
   // (base + 2) % 4
@@ -198,39 +271,136 @@ index Dictionary::computeIndex(index kmer,
   }
 }
 
+// Pushes the k-mers of every length ending at the current base.
+// kmer holds the last kmax_ bases, kmer_reverse their reverse complement,
+// and n is the number of bases read so far.
+void Dictionary::pushKmers(std::vector<index>& ngrams,
+                           uint64_t kmer,
+                           uint64_t kmer_reverse,
+                           int n) const {
+  const int8_t kend = std::min<int>(n, kmax_);
+  for (int8_t k = kmin_; k <= kend; k++) {
+    uint64_t forward = kmer & kmerMask(k);
+    uint64_t reverse = kmer_reverse >> 2*(kmax_ - k);
+    if (isHashed(k)) {
+      ngrams.push_back(hashKmer(forward, reverse, k));
+    } else {
+      ngrams.push_back(offsets_[k] + computeIndex(forward, reverse, k));
+    }
+  }
+}
+
+/*
+K-mer sampling
+With -sampling minimizer, only the k-mer with the smallest hash in each
+window of args_->window consecutive k-mers is kept. With -sampling syncmer,
+a k-mer is kept when its smallest s-mer sits in its middle, which does not
+depend on the strand when k - s is even. Hashes are computed on canonical
+k-mers (s-mers) of length minn, and all the k-mer lengths ending at a kept
+position are pushed.
+*/
+
+// p is the position of the new k-mer, best the position of the current
+// minimizer, or -1 before the first k-mer
+void Dictionary::pushMinimizer(std::vector<index>& ngrams,
+                               std::vector<kmer_entry>& window,
+                               const kmer_entry& e,
+                               int p,
+                               int& best) const {
+  const int w = window.size();
+  bool changed = false;
+  window[p % w] = e;
+  if (best < 0 || p - best >= w) {
+    // the minimizer left the window, look for the new one
+    best = std::max(0, p - w + 1);
+    for (int q = best + 1; q <= p; q++) {
+      if (window[q % w].hash < window[best % w].hash) {
+        best = q;
+      }
+    }
+    changed = true;
+  } else if (e.hash < window[best % w].hash) {
+    best = p;
+    changed = true;
+  }
+  if ((changed && p >= w - 1) || p == w - 1) {
+    const kmer_entry& m = window[best % w];
+    pushKmers(ngrams, m.kmer, m.kmer_reverse, m.n);
+  }
+}
+
+// window holds the hashes of the last k - s + 1 s-mers, n is the number
+// of bases read so far
+void Dictionary::pushSyncmer(std::vector<index>& ngrams,
+                             std::vector<kmer_entry>& window,
+                             uint64_t kmer,
+                             uint64_t kmer_reverse,
+                             int n) const {
+  const int8_t s = args_->smer;
+  if (n < s) {
+    return;
+  }
+  const int w = window.size();
+  uint64_t forward = kmer & kmerMask(s);
+  uint64_t reverse = kmer_reverse >> 2*(kmax_ - s);
+  window[(n - s) % w].hash = hashCanonical(forward, reverse, s);
+  if (n < kmin_) {
+    return;
+  }
+  // s-mers of the k-mer are numbered n - k to n - s
+  const uint64_t middle = window[(n - kmin_ + (w - 1) / 2) % w].hash;
+  for (int q = n - kmin_; q <= n - s; q++) {
+    if (window[q % w].hash < middle) {
+      return;
+    }
+  }
+  pushKmers(ngrams, kmer, kmer_reverse, n);
+}
+
 bool Dictionary::readSequence(std::istream& in,
                               std::vector<index>& ngrams,
                               const int length,
                               bool add_noise,
-                              std::mt19937_64& rng) const {
+                              std::mt19937_64& rng,
+                              std::vector<int32_t>* counts) const {
   // If length is -1, read all sequence
+  // If counts is given, counts[b] is the number of ngrams pushed
+  // after reading b bases
 
-  const int8_t k = args_->minn;
-  // mask to keep the index values between 0 and 4**k-1
-  index mask = (1 << 2*k) - 1;
-  index index = 0, index_reverse = 0;
+  // mask to keep the last kmax_ bases
+  const uint64_t mask = kmerMask(kmax_);
+  uint64_t kmer = 0, kmer_reverse = 0;
   int c;
-  int8_t val, val_reverse;
+  int8_t val;
 
   ngrams.clear();
+  if (counts) {
+    counts->assign(1, 0);
+  }
 
   std::streambuf& sb = *in.rdbuf();
 
   int32_t noise;
   std::uniform_real_distribution<> uniform(1, 100000);
 
+  const sampling_name sampling = args_->sampling;
+  std::vector<kmer_entry> window;
+  int best = -1;
+  if (sampling == sampling_name::minimizer) {
+    window.resize(args_->window);
+  } else if (sampling == sampling_name::syncmer) {
+    window.resize(kmin_ - args_->smer + 1);
+  }
+
   int i = 0;
   while (length == -1 || i < length) {
-    if (i >= k) {
-      ngrams.push_back(computeIndex(index, index_reverse, k));
-    }
     c = sb.sbumpc();
     if (c == BOS || c == EOF) {
       // Reached end of sequence
       if (c == BOS) {
         sb.sungetc();
       }
-      return (i >= k);
+      break;
     }
     switch(c) {
       case 'A' :
@@ -241,37 +411,44 @@ bool Dictionary::readSequence(std::istream& in,
       case 'G' : { val = 2; break;}
       case 't' :
       case 'T' : { val = 3; break;}
-      default : val = -1;
+      default : continue;
     }
-    if (val >= 0) {
-      if (add_noise) {
-        noise = uniform(rng);
-        // random mutation
-        if (noise <= args_->noise) {
-          val = noise % 4;
-        }
-      }
-      val_reverse = 3 - val;
-
-      index *=  4;
-      index += val;
-      if (i < k) {
-        index_reverse += val_reverse << 2*i;
+    if (add_noise) {
+      noise = uniform(rng);
+      // random mutation
+      if (noise <= args_->noise) {
+        val = noise % 4;
       }
-      else {
-        index_reverse /= 4;
-        index_reverse += val_reverse << 2*(k-1);
-        index &= mask;
-        index_reverse &= mask;
+    }
+    kmer = ((kmer << 2) + val) & mask;
+    kmer_reverse = (kmer_reverse >> 2) + (uint64_t(3 - val) << 2*(kmax_-1));
+    i++;
+    if (sampling == sampling_name::syncmer) {
+      pushSyncmer(ngrams, window, kmer, kmer_reverse, i);
+    } else if (i >= kmin_) {
+      if (sampling == sampling_name::minimizer) {
+        kmer_entry e = {kmer, kmer_reverse,
+          hashCanonical(kmer & kmerMask(kmin_),
+                        kmer_reverse >> 2*(kmax_ - kmin_), kmin_), i};
+        pushMinimizer(ngrams, window, e, i - kmin_, best);
+      } else {
+        pushKmers(ngrams, kmer, kmer_reverse, i);
       }
-      i++;
+    }
+    if (counts) {
+      counts->push_back(ngrams.size());
     }
   }
-  if (i >= k) {
-    ngrams.push_back(computeIndex(index, index_reverse, k));
-    return true;
+  if (sampling == sampling_name::minimizer && best >= 0 &&
+      i - kmin_ < args_->window - 1) {
+    // sequence shorter than one window, keep its minimizer
+    const kmer_entry& m = window[best % window.size()];
+    pushKmers(ngrams, m.kmer, m.kmer_reverse, m.n);
+    if (counts) {
+      counts->back() = ngrams.size();
+    }
   }
-  return false;
+  return (i >= kmin_);
 }
 
 bool Dictionary::readSequence(std::istream& in,
@@ -290,8 +467,16 @@ bool Dictionary::readSequence(std::string& word,
 
 std::string Dictionary::getSequence(index ind) const {
   // Returns the first k-mer in lexicographical order from the pair of possible k-mers
+  if (ind >= ndense_) {
+    throw std::invalid_argument(
+        "Index " + std::to_string(ind) + " is not in a dense k-mer table");
+  }
+  int8_t k = kmax_;
+  while (k > kmin_ && (isHashed(k) || ind < offsets_[k])) {
+    k--;
+  }
   std::string seq;
-  getSequenceRCI(seq, ind, args_->minn);
+  getSequenceRCI(seq, ind - offsets_[k], k);
   // std::cerr << ind << ": " << seq << std::endl;
   return seq; // getSequenceRCI(ind, args_->minn);
 }
@@ -337,6 +522,16 @@ void Dictionary::getSequenceClassic(std::string& seq, index ind, const int8_t k)
   }
 }
 
+// Forgets the sequences of the training file but keeps the label indices,
+// so that the sequences of a new training file, which recounts the labels,
+// can be read
+void Dictionary::clearSequences() {
+  sequences_.clear();
+  nsequences_ = 0;
+  name2label_.clear();
+  counts_.assign(nlabels_, 0);
+}
+
 void Dictionary::readFromFasta(std::istream& fasta, std::istream& labels) {
   std::string line, name;
   entry e;
@@ -40,6 +40,14 @@ struct entry {
   int64_t count;
 };
 
+// k-mer waiting for a sampling decision
+struct kmer_entry {
+  uint64_t kmer;
+  uint64_t kmer_reverse;
+  uint64_t hash;
+  int n;
+};
+
 class Dictionary {
   protected:
     static const int32_t MAX_VOCAB_SIZE = 30000000;
@@ -49,11 +57,25 @@ class Dictionary {
 
     void reset(std::istream&) const;
     void pushHash(std::vector<int32_t>& hashes, int32_t id) const;
+    void initKmers();
+    void pushKmers(std::vector<index>&, uint64_t, uint64_t, int) const;
+    void pushMinimizer(std::vector<index>&, std::vector<kmer_entry>&,
+                       const kmer_entry&, int, int&) const;
+    void pushSyncmer(std::vector<index>&, std::vector<kmer_entry>&,
+                     uint64_t, uint64_t, int) const;
     std::shared_ptr<Args> args_;
     std::vector<entry> sequences_;
     std::map<std::string, std::string> name2label_;
     std::map<std::string, int> label2int_;
 
+    // k-mer lengths read in a single pass, from kmin_ to kmax_
+    int8_t kmin_;
+    int8_t kmax_;
+    // first row of the dense table of each k-mer length
+    std::vector<index> offsets_;
+    // total number of rows in the dense tables
+    index ndense_;
+
     std::vector<real> pdiscard_;
     int32_t nlabels_;
     int32_t nsequences_;
@@ -73,10 +95,19 @@ class Dictionary {
     int64_t ntokens() const;
     bool discard(int32_t, real) const;
     uint32_t hash(const std::string& str) const;
+    bool isHashed(const int8_t k) const;
+    uint64_t hashCanonical(uint64_t kmer, uint64_t kmer_reverse,
+                           const int8_t k) const;
+    index hashKmer(uint64_t kmer, uint64_t kmer_reverse, const int8_t k) const;
     void add(const entry);
     std::string findLabel(const std::string&);
     int labelFromPos(const std::streampos&);
+    int32_t nsequences() const;
+    const entry& getEntry(int32_t) const;
+    int32_t getLabelId(int32_t) const;
+    int32_t sequenceFromPos(int64_t) const;
     void readFromFasta(std::istream& fasta, std::istream& labels);
+    void clearSequences();
     void printDictionary() const;
     void readFromFile(std::istream& in);
     void initTableDiscard(); 
@@ -113,7 +144,8 @@ class Dictionary {
         std::istream& in, std::vector<index>& ngrams,
         const int length,
         bool add_noise,
-        std::mt19937_64&) const;
+        std::mt19937_64&,
+        std::vector<int32_t>* counts = nullptr) const;
     bool readSequence(std::string& word,
                       std::vector<index>& ngrams) const;
 };
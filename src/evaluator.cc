@@ -0,0 +1,320 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "evaluator.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace fasttext {
+
+Taxonomy::Taxonomy(const std::string& filename, const Dictionary& dict) {
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened!");
+  }
+  std::unordered_map<std::string, int32_t> labels;
+  for (int32_t i = 0; i < dict.nlabels(); i++) {
+    labels[dict.getLabel(i)] = i;
+  }
+  std::vector<std::unordered_map<std::string, int32_t>> classes;
+  std::string line, field;
+  std::vector<std::string> fields;
+  bool header = true;
+  while (std::getline(in, line)) {
+    fields.clear();
+    std::istringstream ss(line);
+    while (std::getline(ss, field, '\t')) {
+      fields.push_back(field);
+    }
+    if (fields.empty()) {
+      continue;
+    }
+    if (header && !fields[0].empty() && fields[0][0] == '#') {
+      ranks_.assign(fields.begin() + 1, fields.end());
+      continue;
+    }
+    header = false;
+    auto it = labels.find(fields[0]);
+    if (it == labels.end()) {
+      continue;
+    }
+    for (size_t r = 1; r < fields.size(); r++) {
+      if (fields[r].empty()) {
+        continue;
+      }
+      if (ancestors_.size() < r) {
+        ancestors_.resize(r, std::vector<int32_t>(dict.nlabels(), -1));
+        names_.resize(r);
+        classes.resize(r);
+      }
+      auto c = classes[r - 1].emplace(fields[r], names_[r - 1].size());
+      if (c.second) {
+        names_[r - 1].push_back(fields[r]);
+      }
+      ancestors_[r - 1][it->second] = c.first->second;
+    }
+  }
+  for (size_t r = ranks_.size(); r < ancestors_.size(); r++) {
+    ranks_.push_back("rank" + std::to_string(r + 1));
+  }
+  ranks_.resize(ancestors_.size());
+}
+
+int32_t Taxonomy::nranks() const {
+  return ancestors_.size();
+}
+
+const std::string& Taxonomy::rank(int32_t r) const {
+  return ranks_[r];
+}
+
+const std::vector<std::string>& Taxonomy::names(int32_t r) const {
+  return names_[r];
+}
+
+int32_t Taxonomy::ancestor(int32_t r, int32_t label) const {
+  return ancestors_[r][label];
+}
+
+Evaluator::Evaluator(const Dictionary& dict,
+                     std::shared_ptr<const Taxonomy> taxonomy)
+  : taxonomy_(taxonomy) {
+  for (int32_t i = 0; i < dict.nlabels(); i++) {
+    labels_.push_back(dict.getLabel(i));
+  }
+  const int32_t nranks = taxonomy_ ? taxonomy_->nranks() : 0;
+  levels_.resize(nranks + 1);
+  for (int32_t l = 0; l <= nranks; l++) {
+    Level& level = levels_[l];
+    const size_t nclasses =
+      l == 0 ? labels_.size() : taxonomy_->names(l - 1).size();
+    level.rank = l == 0 ? "label" : taxonomy_->rank(l - 1);
+    level.gold.assign(nclasses, 0);
+    level.predicted.assign(nclasses, 0);
+    level.correct.assign(nclasses, 0);
+    level.nexamples = 0;
+  }
+}
+
+// Name of class c of level l
+const std::string& Evaluator::name(int32_t l, int64_t c) const {
+  return l == 0 ? labels_[c] : taxonomy_->names(l - 1)[c];
+}
+
+void Evaluator::add(Level& level,
+                    const std::vector<int32_t>& truth,
+                    const std::vector<int32_t>& predictions) {
+  if (truth.empty()) {
+    return;
+  }
+  level.nexamples++;
+  for (auto it = truth.cbegin(); it != truth.cend(); ++it) {
+    level.gold[*it]++;
+  }
+  for (auto it = predictions.cbegin(); it != predictions.cend(); ++it) {
+    level.predicted[*it]++;
+    if (std::find(truth.cbegin(), truth.cend(), *it) != truth.cend()) {
+      level.correct[*it]++;
+    }
+  }
+  if (!predictions.empty()) {
+    level.confusion[(uint64_t(truth[0]) << 32) | uint32_t(predictions[0])]++;
+  }
+}
+
+// Adds an example of true labels truth, with predictions sorted by
+// decreasing probability; examples without true label are ignored
+void Evaluator::add(const std::vector<int32_t>& truth,
+                    const std::vector<std::pair<real, int32_t>>& predictions) {
+  predictions_.clear();
+  for (auto it = predictions.cbegin(); it != predictions.cend(); ++it) {
+    predictions_.push_back(it->second);
+  }
+  add(levels_[0], truth, predictions_);
+  for (size_t l = 1; l < levels_.size(); l++) {
+    // several labels can share an ancestor, which then counts once
+    truth_.clear();
+    for (auto it = truth.cbegin(); it != truth.cend(); ++it) {
+      const int32_t c = taxonomy_->ancestor(l - 1, *it);
+      if (c >= 0 && std::find(truth_.cbegin(), truth_.cend(), c) == truth_.cend()) {
+        truth_.push_back(c);
+      }
+    }
+    predictions_.clear();
+    for (auto it = predictions.cbegin(); it != predictions.cend(); ++it) {
+      const int32_t c = taxonomy_->ancestor(l - 1, it->second);
+      if (c >= 0 &&
+          std::find(predictions_.cbegin(), predictions_.cend(), c) == predictions_.cend()) {
+        predictions_.push_back(c);
+      }
+    }
+    add(levels_[l], truth_, predictions_);
+  }
+}
+
+void Evaluator::merge(const Evaluator& other) {
+  for (size_t l = 0; l < levels_.size(); l++) {
+    Level& level = levels_[l];
+    const Level& from = other.levels_[l];
+    for (size_t c = 0; c < level.gold.size(); c++) {
+      level.gold[c] += from.gold[c];
+      level.predicted[c] += from.predicted[c];
+      level.correct[c] += from.correct[c];
+    }
+    for (auto it = from.confusion.cbegin(); it != from.confusion.cend(); ++it) {
+      level.confusion[it->first] += it->second;
+    }
+    level.nexamples += from.nexamples;
+  }
+}
+
+std::shared_ptr<const Taxonomy> Evaluator::taxonomy() const {
+  return taxonomy_;
+}
+
+int32_t Evaluator::nlevels() const {
+  return levels_.size();
+}
+
+const std::string& Evaluator::rank(int32_t l) const {
+  return levels_[l].rank;
+}
+
+int64_t Evaluator::nexamples(int32_t l) const {
+  return levels_[l].nexamples;
+}
+
+double Evaluator::precision(int32_t l) const {
+  const Level& level = levels_[l];
+  int64_t correct = 0, predicted = 0;
+  for (size_t c = 0; c < level.gold.size(); c++) {
+    correct += level.correct[c];
+    predicted += level.predicted[c];
+  }
+  return predicted > 0 ? double(correct) / predicted : 0.0;
+}
+
+double Evaluator::recall(int32_t l) const {
+  const Level& level = levels_[l];
+  int64_t correct = 0, gold = 0;
+  for (size_t c = 0; c < level.gold.size(); c++) {
+    correct += level.correct[c];
+    gold += level.gold[c];
+  }
+  return gold > 0 ? double(correct) / gold : 0.0;
+}
+
+static double f1(double precision, double recall) {
+  return precision + recall > 0 ? 2 * precision * recall / (precision + recall) : 0.0;
+}
+
+void Evaluator::macro(int32_t l, double& precision, double& recall, double& f) const {
+  const Level& level = levels_[l];
+  int64_t npredicted = 0, ngold = 0, nclasses = 0;
+  precision = recall = f = 0.0;
+  for (size_t c = 0; c < level.gold.size(); c++) {
+    const double p = level.predicted[c] > 0 ?
+      double(level.correct[c]) / level.predicted[c] : 0.0;
+    const double r = level.gold[c] > 0 ?
+      double(level.correct[c]) / level.gold[c] : 0.0;
+    if (level.predicted[c] > 0) {
+      precision += p;
+      npredicted++;
+    }
+    if (level.gold[c] > 0) {
+      recall += r;
+      ngold++;
+    }
+    if (level.predicted[c] > 0 || level.gold[c] > 0) {
+      f += f1(p, r);
+      nclasses++;
+    }
+  }
+  precision = npredicted > 0 ? precision / npredicted : 0.0;
+  recall = ngold > 0 ? recall / ngold : 0.0;
+  f = nclasses > 0 ? f / nclasses : 0.0;
+}
+
+// Tab-separated counts and metrics of every class seen in the test set
+// or in the predictions, for every level
+void Evaluator::writeLabels(std::ostream& out) const {
+  out << "rank\tclass\texamples\tpredicted\tcorrect\tprecision\trecall\tf1\n";
+  out << std::setprecision(6);
+  for (size_t l = 0; l < levels_.size(); l++) {
+    const Level& level = levels_[l];
+    for (size_t c = 0; c < level.gold.size(); c++) {
+      if (level.gold[c] == 0 && level.predicted[c] == 0) {
+        continue;
+      }
+      const double p = level.predicted[c] > 0 ?
+        double(level.correct[c]) / level.predicted[c] : 0.0;
+      const double r = level.gold[c] > 0 ?
+        double(level.correct[c]) / level.gold[c] : 0.0;
+      out << level.rank << "\t" << name(l, c) << "\t" << level.gold[c]
+          << "\t" << level.predicted[c] << "\t" << level.correct[c]
+          << "\t" << p << "\t" << r << "\t" << f1(p, r) << "\n";
+    }
+  }
+}
+
+// Tab-separated counts of the pairs of first true class and top prediction
+void Evaluator::writeConfusion(std::ostream& out) const {
+  out << "rank\ttrue\tpredicted\tcount\n";
+  std::vector<std::pair<uint64_t, int64_t>> pairs;
+  for (size_t l = 0; l < levels_.size(); l++) {
+    const Level& level = levels_[l];
+    pairs.assign(level.confusion.cbegin(), level.confusion.cend());
+    std::sort(pairs.begin(), pairs.end());
+    for (auto it = pairs.cbegin(); it != pairs.cend(); ++it) {
+      out << level.rank << "\t" << name(l, it->first >> 32) << "\t"
+          << name(l, it->first & 0xffffffff) << "\t" << it->second << "\n";
+    }
+  }
+}
+
+// Quotes s as a JSON string
+static std::string jsonString(const std::string& s) {
+  std::ostringstream out;
+  out << '"';
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << int(c) << std::dec;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+// One JSON object with the micro and macro averages of every level
+void Evaluator::writeSummary(std::ostream& out) const {
+  out << std::setprecision(6) << "{";
+  for (size_t l = 0; l < levels_.size(); l++) {
+    double p, r, f;
+    macro(l, p, r, f);
+    out << (l > 0 ? ", " : "") << jsonString(levels_[l].rank) << ": "
+        << "{\"examples\": " << levels_[l].nexamples
+        << ", \"precision\": " << precision(l)
+        << ", \"recall\": " << recall(l)
+        << ", \"macro_precision\": " << p
+        << ", \"macro_recall\": " << r
+        << ", \"macro_f1\": " << f << "}";
+  }
+  out << "}" << std::endl;
+}
+
+}
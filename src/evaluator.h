@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dictionary.h"
+#include "real.h"
+
+namespace fasttext {
+
+/*
+Taxonomy
+One line per label, followed by its ancestors from the lowest rank to the
+highest, separated by tabs, as written by fastdna simulate:
+
+  genome_0  clade_0
+  genome_1  clade_1
+
+An optional first line starting with # names the ranks (#label genus
+family ...), they are called rank1, rank2, ... otherwise.
+*/
+class Taxonomy {
+ protected:
+  std::vector<std::string> ranks_;
+  // ancestors_[r][label] is the class of the ancestor of label at rank r,
+  // or -1 if unknown, names_[r] the names of the classes of rank r
+  std::vector<std::vector<int32_t>> ancestors_;
+  std::vector<std::vector<std::string>> names_;
+
+ public:
+  Taxonomy(const std::string&, const Dictionary&);
+
+  int32_t nranks() const;
+  const std::string& rank(int32_t) const;
+  const std::vector<std::string>& names(int32_t) const;
+  int32_t ancestor(int32_t, int32_t) const;
+};
+
+/*
+Evaluation
+For every class, counts the test examples of the class, the predictions of
+the class among the top k of every example and the correct ones, from which
+follow per-class precision, recall and F1. Micro averages are P@k and R@k;
+macro precision is averaged over the predicted classes and macro recall
+over the classes of the examples, as python/fastDNA/evaluate.py does. The
+confusion of the top prediction with the first true class is kept as a
+sparse count per pair of classes.
+
+Levels are the labels of the model, then every rank of the taxonomy, to
+which labels and predictions are rolled up. Every thread fills its own
+Evaluator, the Evaluators are merged at the end.
+*/
+class Evaluator {
+ protected:
+  struct Level {
+    std::string rank;
+    std::vector<int64_t> gold;
+    std::vector<int64_t> predicted;
+    std::vector<int64_t> correct;
+    std::unordered_map<uint64_t, int64_t> confusion;
+    int64_t nexamples;
+  };
+
+  std::vector<std::string> labels_;
+  std::shared_ptr<const Taxonomy> taxonomy_;
+  std::vector<Level> levels_;
+  std::vector<int32_t> truth_;
+  std::vector<int32_t> predictions_;
+
+  void add(Level&, const std::vector<int32_t>&, const std::vector<int32_t>&);
+  const std::string& name(int32_t, int64_t) const;
+
+ public:
+  Evaluator(const Dictionary&, std::shared_ptr<const Taxonomy>);
+
+  void add(const std::vector<int32_t>&,
+           const std::vector<std::pair<real, int32_t>>&);
+  void merge(const Evaluator&);
+
+  std::shared_ptr<const Taxonomy> taxonomy() const;
+  int32_t nlevels() const;
+  const std::string& rank(int32_t) const;
+  int64_t nexamples(int32_t = 0) const;
+  double precision(int32_t = 0) const;
+  double recall(int32_t = 0) const;
+  void macro(int32_t, double&, double&, double&) const;
+
+  void writeLabels(std::ostream&) const;
+  void writeConfusion(std::ostream&) const;
+  void writeSummary(std::ostream&) const;
+};
+
+}
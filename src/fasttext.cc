@@ -8,12 +8,19 @@
  */
 
 #include "fasttext.h"
+#include "cascade.h"
+#include "coordinator.h"
+#include "evaluator.h"
+#include "profiler.h"
 
+#include <condition_variable>
+#include <cstdio>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <thread>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <algorithm>
 #include <stdexcept>
@@ -22,10 +29,19 @@
 
 namespace fasttext {
 
-constexpr int32_t FASTTEXT_VERSION = 12; /* Version 1b */
+constexpr int32_t FASTTEXT_VERSION = 15; /* Version 1b */
 constexpr int32_t FASTTEXT_FILEFORMAT_MAGIC_INT32 = 793712314;
 
-FastText::FastText() : quant_(false) {}
+FastText::FastText()
+    : startTokenCount_(0),
+      checkpointRequest_(0),
+      checkpointReady_(0),
+      rank_(0),
+      nworkers_(1),
+      pause_(false),
+      paused_(0),
+      running_(0),
+      quant_(false) {}
 
 void FastText::addInputVector(Vector& vec, index ind) const {
   if (quant_) {
@@ -51,14 +67,57 @@ std::shared_ptr<const Matrix> FastText::getOutputMatrix() const {
   return output_;
 }
 
+std::shared_ptr<const Model> FastText::getModel() const {
+  return model_;
+}
+
+// The cache must not outlive the k and threshold it was filled with
+void FastText::setPredictionCache(std::shared_ptr<PredictionCache> cache) {
+  predictionCache_ = cache;
+}
+
+void FastText::setEarlyExit(std::shared_ptr<EarlyExit> earlyExit) {
+  earlyExit_ = earlyExit;
+}
+
+void FastText::setCascade(std::shared_ptr<Cascade> cascade) {
+  if (cascade && (args_->loss == loss_name::hs ||
+                  cascade->nlabels() != dict_->nlabels())) {
+    throw std::invalid_argument(
+        "A cascade needs the labels of the model, without hierarchical softmax!");
+  }
+  cascade_ = cascade;
+}
+
+// The index must be built from the output matrix of the model
+void FastText::setOutputIndex(std::shared_ptr<OutputIndex> index) {
+  if (index && (args_->loss == loss_name::hs ||
+                index->nlabels() != dict_->nlabels())) {
+    throw std::invalid_argument(
+        "An output index needs the labels of the model, without hierarchical softmax!");
+  }
+  outputIndex_ = index;
+}
+
+// The panel must be built from the output matrix of the model
+void FastText::setPanel(std::shared_ptr<Panel> panel) {
+  if (panel && (args_->loss == loss_name::hs ||
+                panel->nlabels() != dict_->nlabels())) {
+    throw std::invalid_argument(
+        "A panel needs the labels of the model, without hierarchical softmax!");
+  }
+  panel_ = panel;
+}
+
 index FastText::getWordId(std::string& word) const {
   // FIXME returns -1 but is not allowed to
-  if (word.size() != args_->minn) {
+  if (word.size() < args_->minn || word.size() > std::max(args_->minn, args_->maxn)) {
     return -1;
   }
   std::vector<index> ngrams;
   dict_->readSequence(word, ngrams);
-  return ngrams.empty() ? -1 : ngrams[0];
+  // the k-mer spanning the whole word is the last one read
+  return ngrams.empty() ? -1 : ngrams.back();
 }
 
 int32_t FastText::getSubwordId(const std::string& word) const {
@@ -165,6 +224,11 @@ void FastText::saveModel(const std::string path) {
   if (!ofs.is_open()) {
     throw std::invalid_argument(path + " cannot be opened for saving!");
   }
+  saveModel(ofs);
+  ofs.close();
+}
+
+void FastText::saveModel(std::ostream& ofs) {
   signModel(ofs);
   args_->save(ofs);
   dict_->save(ofs);
@@ -183,7 +247,75 @@ void FastText::saveModel(const std::string path) {
     output_->save(ofs);
   }
 
+  const int32_t treeSize = tree_.size();
+  ofs.write((char*)&treeSize, sizeof(int32_t));
+  ofs.write((char*)tree_.data(), treeSize * sizeof(int32_t));
+}
+
+/*
+Checkpoints
+A checkpoint is a model file followed by the training state: the RNG
+states of the training threads and the progress counter when the first of
+them was published. It is written by a
+background thread straight from the shared matrices, while the training
+threads keep updating them, so like any Hogwild read it mixes rows of
+slightly different ages. It is first written to <output>.checkpoint.tmp,
+then renamed to <output>.checkpoint.
+*/
+void FastText::saveCheckpoint(int64_t tokenCount,
+                              const std::vector<std::string>& rngStates) {
+  const std::string path = args_->output + ".checkpoint";
+  const std::string tmp = path + ".tmp";
+  std::ofstream ofs(tmp, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(tmp + " cannot be opened for saving!");
+  }
+  saveModel(ofs);
+  const int32_t nthreads = rngStates.size();
+  ofs.write((char*) &tokenCount, sizeof(int64_t));
+  ofs.write((char*) &nthreads, sizeof(int32_t));
+  for (const auto& state : rngStates) {
+    dict_->saveString(ofs, state);
+  }
   ofs.close();
+  if (!ofs || std::rename(tmp.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error(path + " could not be written!");
+  }
+}
+
+// Whether the loaded model has the k-mers and layers that args describe
+bool FastText::sameArchitecture(const Args& args) const {
+  return args_->dim == args.dim && args_->minn == args.minn &&
+    args_->maxn == args.maxn && args_->denseK == args.denseK &&
+    args_->bucket == args.bucket && args_->sampling == args.sampling &&
+    args_->loss == args.loss && args_->model == args.model;
+}
+
+void FastText::loadCheckpoint(const Args& args) {
+  const std::string path = args.output + ".checkpoint";
+  std::ifstream ifs(path, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(path + " cannot be opened for resuming!");
+  }
+  if (!checkModel(ifs)) {
+    throw std::invalid_argument(path + " has wrong file format!");
+  }
+  loadModel(ifs);
+  if (!sameArchitecture(args)) {
+    throw std::invalid_argument(
+        path + " was trained with different arguments!");
+  }
+  int32_t nthreads;
+  ifs.read((char*) &startTokenCount_, sizeof(int64_t));
+  ifs.read((char*) &nthreads, sizeof(int32_t));
+  rngStates_.assign(nthreads, std::string());
+  for (int32_t i = 0; i < nthreads; i++) {
+    dict_->loadString(ifs, rngStates_[i]);
+  }
+  if (!ifs) {
+    throw std::invalid_argument(path + " is truncated!");
+  }
+  ifs.close();
 }
 
 void FastText::loadModel(const std::string& filename) {
@@ -205,9 +337,9 @@ void FastText::loadModel(std::istream& in) {
   qinput_ = std::make_shared<QMatrix>();
   qoutput_ = std::make_shared<QMatrix>();
   // std::cerr << "Loading args" << std::endl;
-  args_->load(in);
-  if (version == 11 && args_->model == model_name::sup) {
-    // backward compatibility: old supervised models do not use char ngrams.
+  args_->load(in, version);
+  if (version < 13) {
+    // backward compatibility: older models only read k-mers of length minn.
     args_->maxn = 0;
   }
   // std::cerr << "Loading dict" << std::endl;
@@ -237,27 +369,38 @@ void FastText::loadModel(std::istream& in) {
     output_->load(in);
   }
 
+  tree_.clear();
+  if (version >= 15) {
+    int32_t treeSize;
+    in.read((char*) &treeSize, sizeof(int32_t));
+    tree_.resize(treeSize);
+    in.read((char*) tree_.data(), treeSize * sizeof(int32_t));
+  }
+
   model_ = std::make_shared<Model>(input_, output_, args_, 0);
   model_->quant_ = quant_;
   model_->setQuantizePointer(qinput_, qoutput_, args_->qout);
   
  // std::cerr << " set counts" << std::endl;
   if (args_->model == model_name::sup) {
-    model_->setTargetCounts(dict_->getLabelCounts());
+    model_->setTargetCounts(dict_->getLabelCounts(), tree_);
   } else {
     // model_->setTargetCounts(dict_->getCounts(entry_type::word));
   }
 }
 
 void FastText::printInfo(real progress, real loss, std::ostream& log_stream) {
-  // clock_t might also only be 32bits wide on some systems
-  double t = double(clock() - start_) / double(CLOCKS_PER_SEC);
+  // wall-clock time, so that throughput is not summed over threads
+  double t = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_).count();
   double lr = args_->lr * (1.0 - progress);
   double wst = 0;
   int64_t eta = 720 * 3600; // Default to one month
-  if (progress > 0 && t >= 0) {
-    eta = int(t / progress * (1 - progress));
-    wst = double(tokenCount_) / t / args_->thread;
+  // a resumed training only counts the fragments of this run
+  const int64_t ntokens = tokenCount_ - startTokenCount_;
+  if (ntokens > 0 && t >= 0) {
+    eta = int(t / ntokens * (tokenCount_ / progress - tokenCount_));
+    wst = double(ntokens) / t / args_->thread;
   }
   int32_t etah = eta / 3600;
   int32_t etam = (eta % 3600) / 60;
@@ -273,6 +416,42 @@ void FastText::printInfo(real progress, real loss, std::ostream& log_stream) {
   log_stream << std::flush;
 }
 
+// Writes a JSON line with the statistics of all training threads
+void FastText::printStats(real progress, std::ostream& out) {
+  double t = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_).count();
+  int64_t fragments = 0, rejected = 0;
+  double sampling = 0, tokenizing = 0, forward = 0, backward = 0, loss = 0;
+  std::ostringstream perThread;
+  for (int32_t i = 0; i < args_->thread; i++) {
+    const TrainStats& s = stats_[i];
+    const int64_t n = s.fragments;
+    fragments += n;
+    // mean of the losses of the threads, weighted by their fragments
+    loss += n * double(s.loss);
+    rejected += s.rejected;
+    sampling += s.samplingTime * 1e-9;
+    tokenizing += s.tokenizingTime * 1e-9;
+    forward += s.forwardTime * 1e-9;
+    backward += s.backwardTime * 1e-9;
+    perThread << (i > 0 ? ", " : "") << (t > 0 ? n / t : 0.0);
+  }
+  int64_t samples = fragments + rejected;
+  out << std::setprecision(6);
+  out << "{\"time\": " << t
+      << ", \"progress\": " << progress
+      << ", \"fragments\": " << fragments
+      << ", \"fragments_per_sec\": " << (t > 0 ? fragments / t : 0.0)
+      << ", \"fragments_per_sec_thread\": [" << perThread.str() << "]"
+      << ", \"rejection_rate\": " << (samples > 0 ? double(rejected) / samples : 0.0)
+      << ", \"lr\": " << args_->lr * (1.0 - progress)
+      << ", \"loss\": " << (fragments > 0 ? loss / fragments : 0.0)
+      << ", \"thread_time\": {\"sampling\": " << sampling
+      << ", \"tokenizing\": " << tokenizing
+      << ", \"forward\": " << forward
+      << ", \"backward\": " << backward << "}}" << std::endl;
+}
+
 std::vector<int32_t> FastText::selectEmbeddings(int32_t cutoff) const {
   Vector norms(input_->size(0));
   input_->l2NormRow(norms);
@@ -327,7 +506,7 @@ void FastText::quantize(const Args qargs) {
   model_->quant_ = quant_;
   model_->setQuantizePointer(qinput_, qoutput_, args_->qout);
   if (args_->model == model_name::sup) {
-    model_->setTargetCounts(dict_->getLabelCounts());
+    model_->setTargetCounts(dict_->getLabelCounts(), tree_);
   } else {
     // model_->setTargetCounts(dict_->getCounts(entry_type::word));
   }
@@ -380,67 +559,261 @@ std::tuple<int64_t, double, double> FastText::test(
     std::istream& labelfile,
     int32_t k,
     real threshold) {
-  int32_t nexamples = 0, nlabels = 0, npredictions = 0;
-  double precision = 0.0;
-  std::vector<index> line;
-  std::vector<int32_t> labels;
-  // dict_->printDictionary();
-  while (in.peek() != EOF) {
-    dict_->getLine(in, line);
-    dict_->getLabels(labelfile, labels);
-    if (labels.size() > 0 && line.size() > 0) {
-      std::vector<std::pair<real, int32_t>> modelPredictions;
-      model_->predict(line, k, threshold, modelPredictions);
-      for (auto it = modelPredictions.cbegin(); it != modelPredictions.cend(); it++) {
-        if (std::find(labels.begin(), labels.end(), it->second) != labels.end()) {
-          precision += 1.0;
-        }
+  Evaluator evaluator(*dict_, nullptr);
+  test(in, nullptr, labelfile, k, threshold, 1, false, evaluator);
+  return std::tuple<int64_t, double, double>(
+      evaluator.nexamples(), evaluator.precision(), evaluator.recall());
+}
+
+// reads per chunk of FastText::classify
+static const size_t CLASSIFY_CHUNK = 16384;
+
+/*
+Parallel classification
+The reads, their mates if mates is given (mates may be in itself for
+interleaved pairs) and their labels if labelfile is given, are read by
+chunks; while the threads classify a chunk, the next chunk is read.
+callback is called by thread t with the index of the read in its chunk,
+its labels and its predictions, for every read with k-mers (and with a
+label of the model if labelfile is given), then flush is called with the
+size of the chunk once it is classified. Returns the number of reads.
+
+The two mates of a pair are classified by a single hidden vector over the
+union of their k-mers, or by the average of their posteriors if average
+is set. Hidden vectors are scored in batches by Model::predictBlock.
+If a prediction cache is set, reads (or pairs) with the same k-mers as a
+read already classified take its predictions from the cache. If early exit
+is set, reads longer than its chunk are classified one by one by
+Model::predictEarlyExit. Other reads are classified one by one over the
+labels shortlisted by the cascade if set, else over the candidates of the
+output index if set, else over the labels of the panel if set.
+*/
+int64_t FastText::classify(
+    std::istream& in,
+    std::istream* mates,
+    std::istream* labelfile,
+    int32_t k,
+    real threshold,
+    int32_t thread,
+    bool average,
+    const ClassifyCallback& callback,
+    const std::function<void(size_t)>& flush) const {
+  const int32_t nthreads = std::max(thread, 1);
+  const size_t CHUNK = CLASSIFY_CHUNK;
+  const int64_t BATCH = 64;
+  std::vector<std::string> reads[2], mateReads[2];
+  std::vector<std::vector<int32_t>> labels[2];
+  std::string line;
+  auto readRecord = [&](std::istream& stream, std::string& read) {
+    read.clear();
+    if (stream.peek() == Dictionary::BOS) {
+      std::getline(stream, line);
+    }
+    while (stream.peek() != EOF && stream.peek() != Dictionary::BOS) {
+      std::getline(stream, line);
+      read += line;
+    }
+  };
+  auto readChunk = [&](int32_t c) {
+    size_t n = 0;
+    while (n < CHUNK && in.peek() != EOF) {
+      if (reads[c].size() <= n) {
+        reads[c].resize(n + 1);
+        mateReads[c].resize(n + 1);
+        labels[c].resize(n + 1);
       }
-      nexamples++;
-      nlabels += labels.size();
-      npredictions += modelPredictions.size();
+      readRecord(in, reads[c][n]);
+      if (mates) {
+        readRecord(*mates, mateReads[c][n]);
+      }
+      if (labelfile) {
+        dict_->getLabels(*labelfile, labels[c][n]);
+      }
+      n++;
+    }
+    return n;
+  };
+  auto tokenize = [&](std::string& read, std::vector<index>& words) {
+    MemoryBuffer mb(&read[0], read.size());
+    std::istream is(&mb);
+    dict_->readSequence(is, words, -1);
+  };
+  int64_t nreads = 0;
+  size_t n = readChunk(0);
+  for (int32_t c = 0; n > 0; c = 1 - c) {
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t < nthreads; t++) {
+      threads.push_back(std::thread([&, c, t]() {
+        const size_t begin = n * t / nthreads, end = n * (t + 1) / nthreads;
+        std::vector<index> words, mateWords;
+        Vector hidden(args_->dim), hidden2(args_->dim);
+        Vector output(dict_->nlabels()), output2(dict_->nlabels());
+        Matrix hiddens(BATCH, args_->dim);
+        std::vector<size_t> rows;
+        std::vector<uint64_t> keys;
+        std::vector<std::vector<std::pair<real, int32_t>>> heaps(BATCH);
+        std::vector<std::pair<real, int32_t>> cached;
+        std::unique_ptr<Cascade::State> cascadeState(
+            cascade_ ? new Cascade::State(*cascade_) : nullptr);
+        std::vector<int32_t> shortlist;
+        OutputIndex::State indexState;
+        std::vector<real> panelScores;
+        for (size_t i = begin; i < end; ) {
+          rows.clear();
+          keys.clear();
+          for (; i < end && rows.size() < size_t(BATCH); i++) {
+            if (labelfile && labels[c][i].empty()) {
+              continue;
+            }
+            tokenize(reads[c][i], words);
+            if (mates) {
+              tokenize(mateReads[c][i], mateWords);
+            }
+            if (words.empty() && (!mates || mateWords.empty())) {
+              continue;
+            }
+            uint64_t key = 0;
+            if (predictionCache_) {
+              key = PredictionCache::hash(words);
+              if (mates) {
+                key = PredictionCache::hash(mateWords, key);
+              }
+              if (predictionCache_->get(key, cached)) {
+                callback(t, i, labels[c][i], cached);
+                continue;
+              }
+            }
+            if (mates) {
+              if (average && !words.empty() && !mateWords.empty()) {
+                model_->predict_paired(words, mateWords, k, threshold, heaps[0],
+                                       hidden, hidden2, output, output2);
+                if (predictionCache_) {
+                  predictionCache_->put(key, heaps[0]);
+                }
+                callback(t, i, labels[c][i], heaps[0]);
+                continue;
+              }
+              words.insert(words.end(), mateWords.begin(), mateWords.end());
+            }
+            if (earlyExit_ && int64_t(words.size()) > earlyExit_->chunk) {
+              const int64_t consumed = model_->predictEarlyExit(
+                  words, k, threshold, earlyExit_->margin, earlyExit_->chunk,
+                  heaps[0], hidden, output);
+              earlyExit_->reads++;
+              earlyExit_->exited += consumed < int64_t(words.size());
+              earlyExit_->kmers += words.size();
+              earlyExit_->consumed += consumed;
+              if (predictionCache_) {
+                predictionCache_->put(key, heaps[0]);
+              }
+              callback(t, i, labels[c][i], heaps[0]);
+              continue;
+            }
+            model_->computeHidden(words, hidden);
+            if (cascade_) {
+              cascade_->shortlist(reads[c][i], mates ? &mateReads[c][i] : nullptr,
+                                  *cascadeState, shortlist);
+              model_->predictShortlist(hidden, shortlist, k, threshold,
+                                       heaps[0], output);
+            } else if (outputIndex_) {
+              outputIndex_->predict(hidden, k, threshold, heaps[0], indexState);
+            } else if (panel_) {
+              panel_->predict(hidden, k, threshold, heaps[0], panelScores);
+            }
+            if (cascade_ || outputIndex_ || panel_) {
+              if (predictionCache_) {
+                predictionCache_->put(key, heaps[0]);
+              }
+              callback(t, i, labels[c][i], heaps[0]);
+              continue;
+            }
+            std::copy(hidden.data(), hidden.data() + args_->dim,
+                      hiddens.data() + rows.size() * args_->dim);
+            rows.push_back(i);
+            keys.push_back(key);
+          }
+          if (rows.empty()) {
+            continue;
+          }
+          model_->predictBlock(hiddens, rows.size(), k, threshold,
+                               heaps.data(), nullptr);
+          for (size_t b = 0; b < rows.size(); b++) {
+            if (predictionCache_) {
+              predictionCache_->put(keys[b], heaps[b]);
+            }
+            callback(t, rows[b], labels[c][rows[b]], heaps[b]);
+          }
+        }
+      }));
     }
-    // else {
-    //   // std::cerr << "line " << line.size() << " label " << " pos " << in.tellg() / 215 << std::endl;
-    // }
+    nreads += n;
+    const size_t current = n;
+    const size_t next = readChunk(1 - c);
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+      it->join();
+    }
+    if (flush) {
+      flush(current);
+    }
+    n = next;
+  }
+  return nreads;
+}
+
+// Every thread fills its own Evaluator, merged into evaluator at the end
+void FastText::test(
+    std::istream& in,
+    std::istream* mates,
+    std::istream& labelfile,
+    int32_t k,
+    real threshold,
+    int32_t thread,
+    bool average,
+    Evaluator& evaluator) const {
+  std::vector<Evaluator> evaluators(
+      std::max(thread, 1), Evaluator(*dict_, evaluator.taxonomy()));
+  classify(in, mates, &labelfile, k, threshold, thread, average,
+    [&](int32_t t, size_t, const std::vector<int32_t>& labels,
+        const std::vector<std::pair<real, int32_t>>& predictions) {
+      evaluators[t].add(labels, predictions);
+    });
+  for (auto it = evaluators.cbegin(); it != evaluators.cend(); ++it) {
+    evaluator.merge(*it);
   }
-  return std::tuple<int64_t, double, double>(
-      nexamples, precision / npredictions, precision / nlabels);
 }
 
+// Every thread fills its own Profiler, merged into profiler at the end;
+// returns the number of reads
+int64_t FastText::profile(
+    std::istream& in,
+    std::istream* mates,
+    int32_t k,
+    real threshold,
+    int32_t thread,
+    bool average,
+    Profiler& profiler) const {
+  std::vector<Profiler> profilers(std::max(thread, 1), Profiler(dict_->nlabels()));
+  const int64_t nreads = classify(in, mates, nullptr, k, threshold, thread, average,
+    [&](int32_t t, size_t, const std::vector<int32_t>&,
+        const std::vector<std::pair<real, int32_t>>& predictions) {
+      profilers[t].add(predictions);
+    });
+  for (auto it = profilers.cbegin(); it != profilers.cend(); ++it) {
+    profiler.merge(*it);
+  }
+  return nreads;
+}
+
+// Interleaved pairs, with averaged posteriors
 std::tuple<int64_t, double, double> FastText::test_paired(
     std::istream& in,
     std::istream& labelfile,
     int32_t k,
     real threshold) {
-  int32_t nexamples = 0, nlabels = 0, npredictions = 0;
-  double precision = 0.0;
-  std::vector<index> line;
-  std::vector<index> line2;
-  std::vector<int32_t> labels;
-  // dict_->printDictionary();
-  while (in.peek() != EOF) {
-    dict_->getLine(in, line);
-    dict_->getLine(in, line2);
-    dict_->getLabels(labelfile, labels);
-    if (labels.size() > 0 && (line.size() > 0 || line2.size() > 0)) {
-      std::vector<std::pair<real, int32_t>> modelPredictions;
-      model_->predict_paired(line, line2, k, threshold, modelPredictions);
-      for (auto it = modelPredictions.cbegin(); it != modelPredictions.cend(); it++) {
-        if (std::find(labels.begin(), labels.end(), it->second) != labels.end()) {
-          precision += 1.0;
-        }
-      }
-      nexamples++;
-      nlabels += labels.size();
-      npredictions += modelPredictions.size();
-    }
-    // else {
-    //   // std::cerr << "line " << line.size() << " label " << " pos " << in.tellg() / 215 << std::endl;
-    // }
-  }
+  Evaluator evaluator(*dict_, nullptr);
+  test(in, &in, labelfile, k, threshold, 1, true, evaluator);
   return std::tuple<int64_t, double, double>(
-      nexamples, precision / npredictions, precision / nlabels);
+      evaluator.nexamples(), evaluator.precision(), evaluator.recall());
 }
 
 void FastText::predict(
@@ -491,8 +864,10 @@ void FastText::predict_paired(
   Vector hidden(args_->dim);
   Vector hidden2(args_->dim);
   Vector output(dict_->nlabels());
+  Vector output2(dict_->nlabels());
   std::vector<std::pair<real,int32_t>> modelPredictions;
-  model_->predict(words, k, threshold, modelPredictions, hidden, output);
+  model_->predict_paired(words, words2, k, threshold, modelPredictions,
+                         hidden, hidden2, output, output2);
   for (auto it = modelPredictions.cbegin(); it != modelPredictions.cend(); it++) {
     predictions.push_back(std::make_pair(it->first, dict_->getLabel(it->second)));
   }
@@ -505,30 +880,129 @@ void FastText::predict(
   bool print_prob,
   real threshold
 ) {
+  predict(in, paired_end ? &in : nullptr, k, print_prob, threshold, 1, true);
+}
+
+// Prints the predictions of every read, or pair of reads, in the order of
+// the input; reads without k-mers get an empty line
+void FastText::predict(
+  std::istream& in,
+  std::istream* mates,
+  int32_t k,
+  bool print_prob,
+  real threshold,
+  int32_t thread,
+  bool average
+) {
+  std::vector<std::string> lines(CLASSIFY_CHUNK);
+  classify(in, mates, nullptr, k, threshold, thread, average,
+    [&](int32_t, size_t i, const std::vector<int32_t>&,
+        const std::vector<std::pair<real, int32_t>>& predictions) {
+      std::ostringstream line;
+      for (auto it = predictions.cbegin(); it != predictions.cend(); it++) {
+        if (it != predictions.cbegin()) {
+          line << " ";
+        }
+        line << dict_->getLabel(it->second);
+        if (print_prob) {
+          line << " " << std::exp(it->first);
+        }
+      }
+      lines[i] = line.str();
+    },
+    [&](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        std::cout << lines[i] << "\n";
+        lines[i].clear();
+      }
+      std::cout << std::flush;
+    });
+}
 
-  std::vector<std::pair<real,std::string>> predictions;
+void FastText::predictWindows(
+  std::istream& in,
+  int32_t window,
+  int32_t stride,
+  int32_t k,
+  bool consensus,
+  bool print_prob,
+  real threshold
+) {
+  if (window <= 0 || stride <= 0) {
+    throw std::invalid_argument("Window and stride need to be 1 or higher!");
+  }
+  std::string header, name;
+  std::vector<index> words;
+  std::vector<int32_t> counts;
+  std::mt19937_64 rng(0);
+  std::vector<std::pair<int32_t, int32_t>> windows, bases;
+  std::vector<std::vector<std::pair<real, int32_t>>> heaps;
+  std::vector<std::pair<real, int32_t>> heap;
+  Vector average(dict_->nlabels());
   while (in.peek() != EOF) {
-    predictions.clear();
-    if (paired_end) {
-      predict_paired(in, k, predictions, threshold);
+    name.clear();
+    if (in.peek() == Dictionary::BOS) {
+      std::getline(in, header);
+      std::istringstream(header.substr(1)) >> name;
+    }
+    dict_->readSequence(in, words, -1, false, rng, &counts);
+    // windows in bases, the last one ends with the sequence
+    const int32_t length = counts.size() - 1;
+    bases.clear();
+    for (int32_t start = 0; start == 0 || start + window <= length;
+         start += stride) {
+      bases.push_back(std::make_pair(start, std::min(start + window, length)));
     }
-    else {
-      predict(in, k, predictions, threshold);
+    if (bases.back().second < length) {
+      bases.push_back(std::make_pair(std::max(0, length - window), length));
     }
-    if (predictions.empty()) {
+    // ngrams fully inside each window
+    windows.clear();
+    auto it = bases.begin();
+    while (it != bases.end()) {
+      int32_t first = std::min(it->first + args_->minn - 1, it->second);
+      int32_t begin = counts[first], end = counts[it->second];
+      if (begin < end) {
+        windows.push_back(std::make_pair(begin, end));
+        ++it;
+      } else {
+        it = bases.erase(it);
+      }
+    }
+    model_->predictWindows(words, windows, k, threshold, heaps, average);
+
+    if (consensus) {
+      heap.clear();
+      if (!windows.empty()) {
+        model_->findKBest(k, threshold, heap, average);
+        std::sort_heap(heap.begin(), heap.end(),
+                       [](const std::pair<real, int32_t>& l,
+                          const std::pair<real, int32_t>& r) {
+                         return l.first > r.first;
+                       });
+      }
+      for (auto p = heap.cbegin(); p != heap.cend(); p++) {
+        if (p != heap.cbegin()) {
+          std::cout << " ";
+        }
+        std::cout << dict_->getLabel(p->second);
+        if (print_prob) {
+          std::cout << " " << std::exp(p->first);
+        }
+      }
       std::cout << std::endl;
       continue;
     }
-    for (auto it = predictions.cbegin(); it != predictions.cend(); it++) {
-      if (it != predictions.cbegin()) {
-        std::cout << " ";
-      }
-      std::cout << it->second;
-      if (print_prob) {
-        std::cout << " " << std::exp(it->first);
+    for (size_t w = 0; w < windows.size(); w++) {
+      std::cout << name << " " << bases[w].first << " " << bases[w].second;
+      for (auto p = heaps[w].cbegin(); p != heaps[w].cend(); p++) {
+        std::cout << " " << dict_->getLabel(p->second);
+        if (print_prob) {
+          std::cout << " " << std::exp(p->first);
+        }
       }
+      std::cout << std::endl;
     }
-    std::cout << std::endl;
   }
 }
 
@@ -624,6 +1098,12 @@ void FastText::analogies(int32_t k) {
   // }
 }
 
+// The current time, or the epoch if the thread times are not wanted
+static std::chrono::steady_clock::time_point clockNow(bool timed) {
+  return timed ? std::chrono::steady_clock::now()
+               : std::chrono::steady_clock::time_point();
+}
+
 void FastText::trainThread(int32_t threadId) {
   std::ifstream ifs(args_->input);
   const int64_t size_ = utils::size(ifs);
@@ -631,26 +1111,77 @@ void FastText::trainThread(int32_t threadId) {
 
   // std::cerr << "\r trainThread " << std::endl;
 
-  std::mt19937_64 rng(threadId);
+  const int32_t seed = threadId + args_->seed + rank_ * args_->thread;
+  std::mt19937_64 rng(seed);
   std::uniform_int_distribution<int64_t> uniform(0, size_-1);
 
-  Model model(input_, output_, args_, threadId);
+  Model model(input_, output_, args_, seed);
+  // the thread times are only written to the statistics file
+  const bool timed = !args_->statsFile.empty();
+  model.setTimed(timed);
   if (args_->model == model_name::sup) {
-    model.setTargetCounts(dict_->getLabelCounts());
+    model.setTargetCounts(dict_->getLabelCounts(), tree_);
   } else {
   }
+  if (!touched_.empty()) {
+    model.setTouchedRows(&touched_);
+  }
+  bool restored = false;
+  if (threadId < rngStates_.size() && !rngStates_[threadId].empty()) {
+    // minstd_rand does not skip whitespace by itself
+    std::istringstream state(rngStates_[threadId]);
+    restored = bool(state >> rng >> std::ws >> model.rng);
+  }
+  if (!restored && startTokenCount_ > 0) {
+    // resumed with more threads than checkpointed, draw new streams
+    rng.seed(threadId + startTokenCount_);
+    model.rng.seed(threadId + startTokenCount_);
+  }
+  int64_t checkpointSeen = checkpointRequest_;
   // FIXME
   const int64_t ntokens = size_ / args_->length; // dict_->ntokens();
+  // each worker process trains on its share of the fragments
+  const int64_t total = (args_->epoch * ntokens + nworkers_ - 1) / nworkers_;
   int64_t localFragmentCount = 0;
+  int64_t localRejected = 0;
+  int64_t samplingTime = 0, tokenizingTime = 0;
+  int64_t forwardTime = 0, backwardTime = 0;
+  TrainStats& stats = stats_[threadId];
   std::vector<index> line;
   std::vector<int32_t> labels;
   int label;
-  while (tokenCount_ < args_->epoch * ntokens) {
-    real progress = real(tokenCount_) / (args_->epoch * ntokens);
+  Vector hidden(args_->dim);
+  while (tokenCount_ < total) {
+    real progress = real(tokenCount_) / total;
     real lr = args_->lr * (1.0 - progress);
-    if (args_->model == model_name::sup) {
+    if (args_->model == model_name::sup && prefixCache_) {
+      auto start = clockNow(timed);
+      const bool sampled = prefixCache_->sample(rng, args_->length, hidden, label);
+      samplingTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          clockNow(timed) - start).count();
+      if (sampled) {
+        localFragmentCount += 1;
+        model.update(hidden, label, lr);
+      } else {
+        localRejected += 1;
+      }
+    } else if (args_->model == model_name::sup && prefetcher_) {
+      auto start = clockNow(timed);
+      const Fragment& fragment = prefetcher_->next(threadId);
+      samplingTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          clockNow(timed) - start).count();
+      labels.assign(1, fragment.label);
+      localFragmentCount += 1;
+      supervised(model, lr, fragment.ngrams, labels);
+    } else if (args_->model == model_name::sup) {
+      auto start = clockNow(timed);
       // Generate random position
-      pos = uniform(rng);
+      if (!newSequenceEnds_.empty() &&
+          std::uniform_real_distribution<>(0, 1)(rng) >= args_->replay) {
+        pos = sampleNewPosition(rng);
+      } else {
+        pos = uniform(rng);
+      }
       // Get that position's label
       label = dict_->labelFromPos(pos);
       // std::cerr << "\rLabel: " << label << std::endl;
@@ -659,11 +1190,21 @@ void FastText::trainThread(int32_t threadId) {
         labels.push_back(label);
         // Go to that position
         utils::seek(ifs, pos);
-        if (dict_->readSequence(ifs, line, args_->length, true, rng)) {
-          localFragmentCount += 1;
-          // std::cerr << "\r supervised " << std::endl;
-          supervised(model, lr, line, labels);
-        }
+      }
+      auto sampled = clockNow(timed);
+      bool read = (label != -1) &&
+        dict_->readSequence(ifs, line, args_->length, true, rng);
+      auto tokenized = clockNow(timed);
+      samplingTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          sampled - start).count();
+      tokenizingTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          tokenized - sampled).count();
+      if (read) {
+        localFragmentCount += 1;
+        // std::cerr << "\r supervised " << std::endl;
+        supervised(model, lr, line, labels);
+      } else {
+        localRejected += 1;
       }
     } else if (args_->model == model_name::cbow) {
       localFragmentCount += dict_->getLine(ifs, line, model.rng);
@@ -674,14 +1215,362 @@ void FastText::trainThread(int32_t threadId) {
     }
     // FIXME watch out for update rate
     if (localFragmentCount > args_->lrUpdateRate) {
+      if (prefetcher_) {
+        localRejected += prefetcher_->takeRejected(threadId);
+      }
+      const int64_t tokenCount = tokenCount_ += localFragmentCount;
+      stats.fragments += localFragmentCount;
+      stats.rejected += localRejected;
+      stats.samplingTime += samplingTime;
+      stats.tokenizingTime += tokenizingTime;
+      stats.forwardTime += model.getForwardTime() - forwardTime;
+      stats.backwardTime += model.getBackwardTime() - backwardTime;
+      stats.loss = model.getLoss();
+      forwardTime = model.getForwardTime();
+      backwardTime = model.getBackwardTime();
+      localFragmentCount = 0;
+      localRejected = 0;
+      samplingTime = 0;
+      tokenizingTime = 0;
+      if (checkpointRequest_ != checkpointSeen) {
+        checkpointSeen = checkpointRequest_;
+        std::ostringstream state;
+        state << rng << " " << model.rng;
+        std::lock_guard<std::mutex> lock(checkpointMutex_);
+        rngStates_[threadId] = state.str();
+        rngCounts_[threadId] = tokenCount;
+        checkpointReady_++;
+      }
+      if (threadId == 0 && args_->verbose > 1)
+        loss_ = model.getLoss();
+      if (pause_) {
+        waitPause();
+      }
+    }
+  }
+  stats.loss = model.getLoss();
+  if (threadId == 0)
+    loss_ = model.getLoss();
+  {
+    std::lock_guard<std::mutex> lock(pauseMutex_);
+    running_--;
+  }
+  pauseCv_.notify_all();
+  ifs.close();
+}
+
+void FastText::waitPause() {
+  std::unique_lock<std::mutex> lock(pauseMutex_);
+  paused_++;
+  pauseCv_.notify_all();
+  pauseCv_.wait(lock, [&]() { return !pause_; });
+  paused_--;
+}
+
+// Returns once every running training thread waits in waitPause
+void FastText::pauseThreads() {
+  std::unique_lock<std::mutex> lock(pauseMutex_);
+  pause_ = true;
+  pauseCv_.wait(lock, [&]() { return paused_ == running_; });
+}
+
+void FastText::resumeThreads() {
+  {
+    std::lock_guard<std::mutex> lock(pauseMutex_);
+    pause_ = false;
+  }
+  pauseCv_.notify_all();
+}
+
+/*
+Deterministic training
+Threads run in bulk-synchronous rounds of lrUpdateRate fragments each.
+Fragment g of the run (thread t, round r, step j: g = (r * nthreads + t) *
+lrUpdateRate + j) is drawn from generators seeded by a hash of (seed, g),
+and its learning rate only depends on g, so that the sequence of examples
+is fixed by the seed and the number of threads.
+During a round, each thread updates a private copy of the output matrix
+and records its input gradients instead of applying them. Between two
+barriers, thread t then merges the rows r with r % nthreads == t: the
+input gradients are applied thread after thread, in the order they were
+computed, and each output row receives the sum of the threads' changes.
+*/
+struct SyncState {
+  std::mutex mutex;
+  std::condition_variable cv;
+  int32_t waiting;
+  int64_t generation;
+  std::vector<std::shared_ptr<Matrix>> outputs;
+  std::vector<InputGradients> gradients;
+
+  void wait(int32_t nthreads) {
+    std::unique_lock<std::mutex> lock(mutex);
+    const int64_t current = generation;
+    if (++waiting == nthreads) {
+      waiting = 0;
+      generation++;
+      cv.notify_all();
+    } else {
+      cv.wait(lock, [&]() { return generation != current; });
+    }
+  }
+};
+
+void FastText::trainThreadSync(int32_t threadId, SyncState& sync) {
+  std::ifstream ifs(args_->input);
+  const int64_t size_ = utils::size(ifs);
+  const int32_t nthreads = args_->thread;
+  const int64_t ntokens = size_ / args_->length;
+  const int64_t total = args_->epoch * ntokens;
+  const int64_t roundSize = std::max(args_->lrUpdateRate, 1);
+
+  std::shared_ptr<Matrix> wo = sync.outputs[threadId];
+  InputGradients& gradients = sync.gradients[threadId];
+  std::mt19937_64 rng;
+  std::uniform_int_distribution<int64_t> uniform(0, size_-1);
+  Model model(input_, wo, args_, 0);
+  model.setTargetCounts(dict_->getLabelCounts(), tree_);
+  model.setInputGradients(&gradients);
+  model.setTimed(!args_->statsFile.empty());
+  TrainStats& stats = stats_[threadId];
+  std::vector<index> line;
+  std::vector<int32_t> labels(1);
+  int64_t forwardTime = 0, backwardTime = 0;
+  for (int64_t base = 0; base < total; base += nthreads * roundSize) {
+    std::copy(output_->data(), output_->data() + output_->size(0) * output_->size(1),
+              wo->data());
+    gradients.clear();
+    const int64_t first = base + threadId * roundSize;
+    const int64_t last = std::min(total, first + roundSize);
+    int64_t rejected = 0;
+    for (int64_t g = first; g < last; g++) {
+      const uint64_t key = utils::mix64(uint64_t(args_->seed) ^ uint64_t(g));
+      for (uint64_t attempt = 0; ; attempt++) {
+        rng.seed(utils::mix64(key + attempt));
+        const int64_t pos = uniform(rng);
+        labels[0] = dict_->labelFromPos(pos);
+        if (labels[0] != -1) {
+          utils::seek(ifs, pos);
+          if (dict_->readSequence(ifs, line, args_->length, true, rng)) {
+            break;
+          }
+        }
+        rejected++;
+      }
+      model.rng.seed(uint32_t(key));
+      supervised(model, args_->lr * (1.0 - real(g) / total), line, labels);
+    }
+    sync.wait(nthreads);
+    for (int32_t u = 0; u < nthreads; u++) {
+      sync.gradients[u].apply(*input_, threadId, nthreads);
+    }
+    const int64_t dim = output_->size(1);
+    for (int64_t r = threadId; r < output_->size(0); r += nthreads) {
+      real* row = output_->data() + r * dim;
+      for (int64_t j = 0; j < dim; j++) {
+        real delta = 0.0;
+        for (int32_t u = 0; u < nthreads; u++) {
+          delta += sync.outputs[u]->at(r, j) - row[j];
+        }
+        row[j] += delta;
+      }
+    }
+    sync.wait(nthreads);
+    stats.fragments += std::max<int64_t>(0, last - first);
+    stats.rejected += rejected;
+    stats.forwardTime += model.getForwardTime() - forwardTime;
+    stats.backwardTime += model.getBackwardTime() - backwardTime;
+    stats.loss = model.getLoss();
+    forwardTime = model.getForwardTime();
+    backwardTime = model.getBackwardTime();
+    if (threadId == 0) {
+      tokenCount_ = std::min(total, base + nthreads * roundSize);
+      loss_ = model.getLoss();
+    }
+  }
+  ifs.close();
+}
+
+/*
+Streaming training
+The training file is cut into shards of shardSize MB, each read at once
+and cut into consecutive fragments of length bases, starting at a random
+offset in every sequence. Every pass visits all the shards in a random
+order, and the threads take the next shard to read from a shared counter,
+so that an epoch is one pass over the data and each label gets exactly
+its share of the fragments, in proportion to the length of its sequences.
+Fragments go through a shuffle buffer per thread before training: once
+the buffer is full, each new fragment replaces a random one, which is
+used for training.
+*/
+struct StreamState {
+  std::atomic<int64_t> next;
+  int64_t size;
+  int64_t shardSize;
+  int64_t nshards;
+  // estimated number of fragments of all the passes of this worker
+  int64_t total;
+
+  // Returns the shard read at index i of the pass, an affine permutation
+  int64_t shard(int64_t pass, int64_t i, int32_t seed) const {
+    std::mt19937_64 rng(utils::mix64(uint64_t(seed) ^ uint64_t(pass)));
+    auto coprime = [this](int64_t a) {
+      int64_t b = nshards;
+      while (b != 0) {
+        std::swap(a, b);
+        b %= a;
+      }
+      return a == 1;
+    };
+    int64_t stride = 1 + rng() % nshards;
+    while (!coprime(stride)) {
+      stride = 1 + rng() % nshards;
+    }
+    return (i * stride + rng() % nshards) % nshards;
+  }
+};
+
+void FastText::trainThreadStream(int32_t threadId, StreamState& stream) {
+  std::ifstream ifs(args_->input);
+  const int32_t seed = threadId + args_->seed + rank_ * args_->thread;
+  std::mt19937_64 rng(seed);
+  Model model(input_, output_, args_, seed);
+  const bool timed = !args_->statsFile.empty();
+  model.setTimed(timed);
+  model.setTargetCounts(dict_->getLabelCounts(), tree_);
+  if (!touched_.empty()) {
+    model.setTouchedRows(&touched_);
+  }
+  TrainStats& stats = stats_[threadId];
+  std::vector<Fragment> buffer(args_->shuffleBuffer);
+  size_t nbuffered = 0;
+  std::vector<index> line;
+  std::vector<int32_t> labels(1);
+  std::vector<char> bytes;
+  std::uniform_int_distribution<int32_t> offset(0, args_->length - 1);
+  int64_t localFragmentCount = 0;
+  int64_t samplingTime = 0, tokenizingTime = 0;
+  int64_t forwardTime = 0, backwardTime = 0;
+
+  auto train = [&](const Fragment& fragment) {
+    const real progress = std::min(1.0, double(tokenCount_) / stream.total);
+    labels[0] = fragment.label;
+    supervised(model, args_->lr * (1.0 - progress), fragment.ngrams, labels);
+    if (++localFragmentCount > args_->lrUpdateRate) {
       tokenCount_ += localFragmentCount;
+      stats.fragments += localFragmentCount;
+      stats.samplingTime += samplingTime;
+      stats.tokenizingTime += tokenizingTime;
+      stats.forwardTime += model.getForwardTime() - forwardTime;
+      stats.backwardTime += model.getBackwardTime() - backwardTime;
+      stats.loss = model.getLoss();
+      forwardTime = model.getForwardTime();
+      backwardTime = model.getBackwardTime();
       localFragmentCount = 0;
+      samplingTime = 0;
+      tokenizingTime = 0;
       if (threadId == 0 && args_->verbose > 1)
         loss_ = model.getLoss();
+      if (pause_) {
+        waitPause();
+      }
     }
+  };
+  auto push = [&](int32_t label) {
+    if (nbuffered < buffer.size()) {
+      buffer[nbuffered].label = label;
+      std::swap(buffer[nbuffered].ngrams, line);
+      nbuffered++;
+      return;
+    }
+    Fragment& fragment = buffer[std::uniform_int_distribution<size_t>(
+        0, buffer.size() - 1)(rng)];
+    train(fragment);
+    fragment.label = label;
+    std::swap(fragment.ngrams, line);
+  };
+
+  // fragments starting near the end of a shard are read past it
+  const int64_t overhang = 2 * args_->length + 4096;
+  for (int64_t i = stream.next++; ; i = stream.next++) {
+    const int64_t g = i * nworkers_ + rank_;
+    const int64_t pass = g / stream.nshards;
+    if (pass >= args_->epoch) {
+      break;
+    }
+    auto start = clockNow(timed);
+    const int64_t first =
+      stream.shard(pass, g % stream.nshards, args_->seed) * stream.shardSize;
+    const int64_t last = std::min(stream.size, first + stream.shardSize);
+    bytes.resize(std::min(stream.size, last + overhang) - first);
+    utils::seek(ifs, first);
+    ifs.read(bytes.data(), bytes.size());
+    bytes.resize(ifs.gcount());
+    auto read = clockNow(timed);
+
+    int32_t sequence = dict_->sequenceFromPos(first);
+    int64_t skip = 0;
+    bool newSequence = first == int64_t(dict_->getEntry(sequence).seq_pos);
+    if (first < int64_t(dict_->getEntry(sequence).seq_pos)) {
+      skip = dict_->getEntry(sequence).seq_pos - first;
+      newSequence = true;
+    }
+    if (skip >= last - first || skip >= bytes.size()) {
+      continue;
+    }
+    MemoryBuffer mb(bytes.data() + skip, bytes.size() - skip);
+    std::istream in(&mb);
+    while (true) {
+      if (newSequence) {
+        const int32_t n = offset(rng);
+        if (n > 0) {
+          dict_->readSequence(in, line, n, false, rng);
+        }
+        newSequence = false;
+      }
+      if (first + skip + int64_t(mb.consumed()) >= last) {
+        break;
+      }
+      if (dict_->readSequence(in, line, args_->length, true, rng)) {
+        push(dict_->getLabelId(sequence));
+      }
+      const int c = mb.sgetc();
+      if (c == EOF) {
+        break;
+      }
+      if (c == Dictionary::BOS) {
+        // skip the header of the next sequence
+        while (mb.sbumpc() != '\n' && mb.sgetc() != EOF) {}
+        if (++sequence >= dict_->nsequences()) {
+          break;
+        }
+        newSequence = true;
+      }
+    }
+    auto tokenized = clockNow(timed);
+    samplingTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        read - start).count();
+    tokenizingTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        tokenized - read).count();
+  }
+  // drain the shuffle buffer in random order
+  std::shuffle(buffer.begin(), buffer.begin() + nbuffered, rng);
+  for (size_t i = 0; i < nbuffered; i++) {
+    train(buffer[i]);
   }
+  tokenCount_ += localFragmentCount;
+  stats.fragments += localFragmentCount;
+  stats.loss = model.getLoss();
   if (threadId == 0)
     loss_ = model.getLoss();
+  {
+    std::lock_guard<std::mutex> lock(pauseMutex_);
+    // the last thread ends the progress whatever the estimate was
+    if (--running_ == 0) {
+      tokenCount_ = std::max<int64_t>(tokenCount_, stream.total);
+    }
+  }
+  pauseCv_.notify_all();
   ifs.close();
 }
 
@@ -701,7 +1590,9 @@ void FastText::loadVectors(std::string filename) {
         ") does not match dimension (" + std::to_string(dict_->nwords()) + "," + std::to_string(args_->dim) + ")!");
   }
   // mat = std::make_shared<Matrix>(n, dim);
-  input_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
+  // the file holds the dense k-mers, the hashed ones start at random
+  input_ = std::make_shared<Matrix>(dict_->nwords() + args_->bucket, args_->dim);
+  input_->uniform(1.0 / args_->dim);
   std::string word;
   for (size_t i = 0; i < n; i++) {
     word.clear();
@@ -714,14 +1605,168 @@ void FastText::loadVectors(std::string filename) {
   // std::cerr << "\rVectors loaded" << std::endl;
 }
 
+/*
+Incremental update
+The new training file must contain the sequences of the loaded model, with
+the same names, labels and lengths, and adds new sequences: the labels of
+the model keep their indices and at least their counts, new labels are
+appended. The output rows of new labels are imprinted: they are the mean
+hidden vector of fragments of the label, scaled to the mean norm of the
+existing rows, so that new labels start with sensible scores instead of
+zero. Hierarchical softmax extends its tree with the new labels, see
+Model::extendTree, so that its internal nodes keep their rows; the tree is
+then saved with the model.
+
+A fraction replay of the fragments is drawn from the whole file, to
+remember the existing labels, the others from the sequences of new labels.
+*/
+void FastText::addSequences() {
+  const int32_t nold = dict_->nlabels();
+  std::vector<entry> old;
+  for (int32_t i = 0; i < dict_->nsequences(); i++) {
+    old.push_back(dict_->getEntry(i));
+  }
+  std::ifstream ifs(args_->input);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(
+        args_->input + " cannot be opened for training!");
+  }
+  std::ifstream labels(args_->labels);
+  if (!labels.is_open()) {
+    throw std::invalid_argument(
+        args_->labels + " cannot be opened for training!");
+  }
+  const int64_t size = utils::size(ifs);
+  utils::seek(ifs, 0);
+  dict_->clearSequences();
+  dict_->readFromFasta(ifs, labels);
+  std::unordered_map<std::string, int32_t> names;
+  for (int32_t i = 0; i < dict_->nsequences(); i++) {
+    names[dict_->getEntry(i).name] = i;
+  }
+  for (auto it = old.cbegin(); it != old.cend(); ++it) {
+    auto found = names.find(it->name);
+    if (found == names.end() ||
+        dict_->getEntry(found->second).label != it->label ||
+        dict_->getEntry(found->second).count != it->count) {
+      throw std::invalid_argument(
+          args_->input + " does not contain sequence " + it->name + " of " +
+          args_->loadModel + "!");
+    }
+  }
+
+  const int32_t nlabels = dict_->nlabels();
+  const int64_t dim = args_->dim;
+  auto output = std::make_shared<Matrix>(nlabels, dim);
+  output->zero();
+  real norm = 0.0;
+  if (args_->loss == loss_name::hs) {
+    // the rows of the nold - 1 internal nodes of the old tree
+    std::copy(output_->data(), output_->data() + (nold - 1) * dim,
+              output->data());
+    tree_ = model_->extendTree(dict_->getLabelCounts());
+  } else {
+    std::copy(output_->data(), output_->data() + output_->size(0) * dim,
+              output->data());
+    for (int32_t i = 0; i < nold; i++) {
+      norm += output_->l2NormRow(i) / nold;
+    }
+  }
+
+  newSequences_.clear();
+  newSequenceEnds_.clear();
+  int64_t total = 0;
+  // the mean hidden vectors of new labels are summed in their output rows,
+  // which are nodes of the tree with hierarchical softmax
+  const bool imprint = args_->loss != loss_name::hs;
+  std::vector<int32_t> nfragments(nlabels - nold, 0);
+  std::mt19937_64 rng(args_->seed);
+  std::vector<index> line;
+  const int32_t nsequences = dict_->nsequences();
+  for (int32_t i = 0; i < nsequences; i++) {
+    const int32_t label = dict_->getLabelId(i);
+    if (label < nold) {
+      continue;
+    }
+    const int64_t begin = dict_->getEntry(i).name_pos;
+    const int64_t end =
+      i + 1 < nsequences ? int64_t(dict_->getEntry(i + 1).name_pos) : size;
+    total += end - begin;
+    newSequences_.push_back(begin);
+    newSequenceEnds_.push_back(total);
+    // a few fragments per sequence are enough for the mean direction
+    const int64_t seqPos = dict_->getEntry(i).seq_pos;
+    std::uniform_int_distribution<int64_t> uniform(seqPos, std::max(seqPos, end - 1));
+    for (int32_t j = 0; imprint && j < 16 && nfragments[label - nold] < 256; j++) {
+      utils::seek(ifs, uniform(rng));
+      if (!dict_->readSequence(ifs, line, args_->length, false, rng)) {
+        continue;
+      }
+      real* mean = output->data() + label * dim;
+      for (auto it = line.cbegin(); it != line.cend(); ++it) {
+        const real* row = input_->data() + int64_t(*it) * dim;
+        for (int64_t k = 0; k < dim; k++) {
+          mean[k] += row[k] / line.size();
+        }
+      }
+      nfragments[label - nold]++;
+    }
+  }
+  for (int32_t i = nold; imprint && i < nlabels; i++) {
+    const real n = output->l2NormRow(i);
+    real* mean = output->data() + i * dim;
+    for (int64_t k = 0; k < dim; k++) {
+      mean[k] = n > 0 ? mean[k] * norm / n : 0.0;
+    }
+  }
+  output_ = output;
+  if (args_->verbose > 0) {
+    std::cerr << "New labels: " << nlabels - nold << std::endl;
+    std::cerr << "Sequences of new labels: " << newSequences_.size() << std::endl;
+    if (!imprint) {
+      std::cerr << "Kept tree nodes: " << nold - 1 << " of " << nlabels - 1
+                << std::endl;
+    }
+  }
+}
+
+// Draws a position uniformly in the sequences of new labels
+int64_t FastText::sampleNewPosition(std::mt19937_64& rng) const {
+  const int64_t x = std::uniform_int_distribution<int64_t>(
+      0, newSequenceEnds_.back() - 1)(rng);
+  const size_t i = std::upper_bound(
+      newSequenceEnds_.cbegin(), newSequenceEnds_.cend(), x) - newSequenceEnds_.cbegin();
+  return newSequences_[i] + x - (i > 0 ? newSequenceEnds_[i - 1] : 0);
+}
+
 void FastText::train(const Args args) {
   args_ = std::make_shared<Args>(args);
-  if (args_->loadModel.size() != 0) {
+  if ((args_->deterministic || args_->stream) &&
+      args_->model != model_name::sup) {
+    throw std::invalid_argument(
+        "Deterministic and streaming training are only supported for supervised models!");
+  }
+  startTokenCount_ = 0;
+  rngStates_.clear();
+  if (args_->resume) {
+    loadCheckpoint(args);
+    args_ = std::make_shared<Args>(args);
+    if (args_->verbose > 0) {
+      std::cerr << "Resuming from fragment " << startTokenCount_ << std::endl;
+    }
+  } else if (args_->loadModel.size() != 0) {
     loadModel(args_->loadModel);
-    // FIXME Check args are compatible??
+    if (args.incremental && (quant_ || !sameArchitecture(args))) {
+      throw std::invalid_argument(
+          args.loadModel + " cannot be updated with these arguments!");
+    }
     args_ = std::make_shared<Args>(args);
+    if (args_->incremental) {
+      addSequences();
+    }
   } else {
     dict_ = std::make_shared<Dictionary>(args_);
+    tree_.clear();
     if (args_->input == "-") {
       // manage expectations
       throw std::invalid_argument("Cannot use stdin for training!");
@@ -756,48 +1801,197 @@ void FastText::train(const Args args) {
   }
   model_ = std::make_shared<Model>(input_, output_, args_, 0);
   if (args_->model == model_name::sup) {
-    model_->setTargetCounts(dict_->getLabelCounts());
+    model_->setTargetCounts(dict_->getLabelCounts(), tree_);
   } else {
     // model_->setTargetCounts(dict_->getCounts(entry_type::word));
   }
+  if (args_->prefixStride > 0 && args_->model == model_name::sup) {
+    prefixCache_.reset(new PrefixCache(args_->prefixStride));
+    prefixCache_->build(args_->input, *dict_, *input_, args_->thread);
+    if (args_->verbose > 0) {
+      std::cerr << "\rCached embedding sums: " << prefixCache_->memory() / 1048576
+                << " MB" << std::endl;
+    }
+  }
   startThreads();
+  prefixCache_.reset();
 }
 
 void FastText::startThreads() {
-  start_ = clock();
-  tokenCount_ = 0;
+  start_ = std::chrono::steady_clock::now();
+  tokenCount_ = startTokenCount_;
+  rngStates_.resize(args_->thread);
+  rngCounts_.assign(args_->thread, 0);
   loss_ = -1;
-  std::vector<std::thread> threads;
+  stats_.reset(new TrainStats[args_->thread]);
   for (int32_t i = 0; i < args_->thread; i++) {
-    threads.push_back(std::thread([=]() { trainThread(i); }));
+    stats_[i].fragments = 0;
+    stats_[i].rejected = 0;
+    stats_[i].samplingTime = 0;
+    stats_[i].tokenizingTime = 0;
+    stats_[i].forwardTime = 0;
+    stats_[i].backwardTime = 0;
+    stats_[i].loss = 0;
+  }
+  std::ofstream statsFile;
+  if (!args_->statsFile.empty()) {
+    statsFile.open(args_->statsFile, std::ofstream::app);
+    if (!statsFile.is_open()) {
+      throw std::invalid_argument(
+          args_->statsFile + " cannot be opened for saving statistics!");
+    }
+  }
+  auto lastStats = start_;
+  auto lastCheckpoint = start_;
+  bool checkpointPending = false;
+  std::thread checkpointWriter;
+  CoordinatorClient coordinator;
+  rank_ = 0;
+  nworkers_ = 1;
+  touched_.clear();
+  if (!args_->coordinator.empty()) {
+    coordinator.connect(args_->coordinator, *input_, *output_);
+    rank_ = coordinator.rank();
+    nworkers_ = coordinator.nworkers();
+    touched_.assign(input_->size(0), 0);
+    if (args_->verbose > 0) {
+      std::cerr << "Worker " << rank_ << " of " << nworkers_ << std::endl;
+    }
+  }
+  running_ = args_->thread;
+  paused_ = 0;
+  pause_ = false;
+  if (args_->prefetch > 0 && args_->model == model_name::sup &&
+      !args_->deterministic) {
+    // ring i draws from the same stream as training thread i would
+    std::vector<uint64_t> seeds;
+    for (int32_t i = 0; i < args_->thread; i++) {
+      seeds.push_back(i + args_->seed + rank_ * args_->thread);
+    }
+    prefetcher_.reset(new Prefetcher(args_, dict_, seeds));
   }
+  std::vector<std::thread> threads;
   // FIXME get file size
   std::ifstream ifs(args_->input);
   const int64_t size_ = utils::size(ifs);
-  const int64_t ntokens = size_ / args_->length; // dict_->ntokens();
+  int64_t ntokens = size_ / args_->length; // dict_->ntokens();
+  StreamState stream;
+  if (args_->stream) {
+    stream.next = 0;
+    stream.size = size_;
+    stream.shardSize = int64_t(args_->shardSize) << 20;
+    stream.nshards = (size_ + stream.shardSize - 1) / stream.shardSize;
+    ntokens = 0;
+    for (int32_t i = 0; i < dict_->nsequences(); i++) {
+      ntokens += dict_->getEntry(i).count / args_->length;
+    }
+    stream.total = (args_->epoch * ntokens + nworkers_ - 1) / nworkers_;
+  }
+  SyncState sync;
+  if (args_->deterministic) {
+    sync.waiting = 0;
+    sync.generation = 0;
+    sync.gradients.resize(args_->thread);
+    for (int32_t i = 0; i < args_->thread; i++) {
+      sync.outputs.push_back(std::make_shared<Matrix>(*output_));
+    }
+  }
+  for (int32_t i = 0; i < args_->thread; i++) {
+    if (args_->deterministic) {
+      threads.push_back(std::thread([&, i]() { trainThreadSync(i, sync); }));
+    } else if (args_->stream) {
+      threads.push_back(std::thread([&, i]() { trainThreadStream(i, stream); }));
+    } else {
+      threads.push_back(std::thread([=]() { trainThread(i); }));
+    }
+  }
+  const int64_t total = (args_->epoch * ntokens + nworkers_ - 1) / nworkers_;
+  int64_t nextSync = args_->syncInterval;
   // Same condition as trainThread
-  while (tokenCount_ < args_->epoch * ntokens) {
+  while (tokenCount_ < total) {
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    real progress = std::min(real(1.0), real(tokenCount_) / total);
     if (loss_ >= 0 && args_->verbose > 1) {
-      real progress = real(tokenCount_) / (args_->epoch * ntokens);
       std::cerr << "\r";
       printInfo(progress, loss_, std::cerr);
     }
+    auto now = std::chrono::steady_clock::now();
+    if (statsFile.is_open() &&
+        now - lastStats >= std::chrono::seconds(args_->statsInterval)) {
+      printStats(progress, statsFile);
+      lastStats = now;
+    }
+    if (args_->checkpointInterval > 0 && !checkpointPending &&
+        now - lastCheckpoint >= std::chrono::seconds(args_->checkpointInterval)) {
+      checkpointReady_ = 0;
+      checkpointRequest_++;
+      checkpointPending = true;
+    }
+    if (checkpointPending && checkpointReady_ == args_->thread) {
+      // all threads published their RNG state: write in the background
+      if (checkpointWriter.joinable()) {
+        checkpointWriter.join();
+      }
+      std::vector<std::string> rngStates;
+      int64_t tokenCount;
+      {
+        std::lock_guard<std::mutex> lock(checkpointMutex_);
+        rngStates = rngStates_;
+        // the fragments after the earliest state are trained again on resume
+        tokenCount = *std::min_element(rngCounts_.begin(), rngCounts_.end());
+      }
+      checkpointWriter = std::thread([this, tokenCount, rngStates]() {
+        try {
+          saveCheckpoint(tokenCount, rngStates);
+        } catch (const std::exception& e) {
+          std::cerr << "\nCheckpoint failed: " << e.what() << std::endl;
+        }
+      });
+      checkpointPending = false;
+      lastCheckpoint = now;
+    }
+    if (!touched_.empty() && tokenCount_ >= nextSync && tokenCount_ < total) {
+      pauseThreads();
+      coordinator.sync(*input_, *output_, touched_, false);
+      resumeThreads();
+      nextSync = tokenCount_ + args_->syncInterval;
+    }
   }
   for (int32_t i = 0; i < args_->thread; i++) {
     threads[i].join();
   }
+  prefetcher_.reset();
+  if (!touched_.empty()) {
+    // waits for the other workers, and gets the final parameters
+    coordinator.sync(*input_, *output_, touched_, true);
+    coordinator.close();
+    touched_.clear();
+  }
+  if (checkpointWriter.joinable()) {
+    checkpointWriter.join();
+  }
+  if (statsFile.is_open()) {
+    printStats(1.0, statsFile);
+  }
   if (args_->verbose > 0) {
       std::cerr << "\r";
       printInfo(1.0, loss_, std::cerr);
       std::cerr << std::endl;
   }
+  if (nworkers_ > 1 && args_->verbose > 1) {
+    std::cerr << "Sent " << coordinator.bytesSent() / 1048576 << " MB, received "
+              << coordinator.bytesReceived() / 1048576 << " MB" << std::endl;
+  }
 }
 
 int FastText::getDimension() const {
     return args_->dim;
 }
 
+int32_t FastText::getRank() const {
+  return rank_;
+}
+
 bool FastText::isQuant() const {
   return quant_;
 }
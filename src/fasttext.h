@@ -12,7 +12,10 @@
 #include <time.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <chrono>
 #include <iostream>
@@ -23,6 +26,11 @@
 #include "dictionary.h"
 #include "matrix.h"
 #include "model.h"
+#include "outputindex.h"
+#include "panel.h"
+#include "prefetcher.h"
+#include "predictioncache.h"
+#include "prefixcache.h"
 #include "qmatrix.h"
 #include "real.h"
 #include "utils.h"
@@ -30,6 +38,42 @@
 
 namespace fasttext {
 
+// Counters of a training thread, published every lrUpdateRate fragments.
+// Times are in nanoseconds.
+struct TrainStats {
+  std::atomic<int64_t> fragments;
+  std::atomic<int64_t> rejected;
+  std::atomic<int64_t> samplingTime;
+  std::atomic<int64_t> tokenizingTime;
+  std::atomic<int64_t> forwardTime;
+  std::atomic<int64_t> backwardTime;
+  std::atomic<real> loss;
+};
+
+// Early exit of the reads longer than chunk k-mers, see
+// Model::predictEarlyExit, and its counters
+struct EarlyExit {
+  real margin;
+  int64_t chunk;
+  std::atomic<int64_t> reads;
+  std::atomic<int64_t> exited;
+  std::atomic<int64_t> kmers;
+  std::atomic<int64_t> consumed;
+
+  EarlyExit(real m, int64_t c)
+    : margin(m), chunk(c), reads(0), exited(0), kmers(0), consumed(0) {}
+};
+
+struct SyncState;
+struct StreamState;
+class Cascade;
+class Evaluator;
+class Profiler;
+
+typedef std::function<void(int32_t, size_t, const std::vector<int32_t>&,
+                           const std::vector<std::pair<real, int32_t>>&)>
+  ClassifyCallback;
+
 class FastText {
  protected:
   std::shared_ptr<Args> args_;
@@ -46,7 +90,54 @@ class FastText {
   std::atomic<int64_t> tokenCount_;
   std::atomic<real> loss_;
 
-  clock_t start_;
+  std::chrono::steady_clock::time_point start_;
+  std::unique_ptr<TrainStats[]> stats_;
+
+  // checkpoints: training threads publish their RNG states in rngStates_,
+  // and the progress counter when they did in rngCounts_, at their next
+  // sync point after checkpointRequest_ is incremented
+  int64_t startTokenCount_;
+  std::atomic<int64_t> checkpointRequest_;
+  std::atomic<int32_t> checkpointReady_;
+  std::mutex checkpointMutex_;
+  std::vector<std::string> rngStates_;
+  std::vector<int64_t> rngCounts_;
+  void saveCheckpoint(int64_t, const std::vector<std::string>&);
+  void loadCheckpoint(const Args&);
+  bool sameArchitecture(const Args&) const;
+
+  // incremental update: positions and cumulative sizes of the sequences
+  // of new labels in the training file
+  std::vector<int64_t> newSequences_;
+  std::vector<int64_t> newSequenceEnds_;
+  void addSequences();
+  int64_t sampleNewPosition(std::mt19937_64&) const;
+  // children of the internal nodes of a hierarchical softmax tree extended
+  // by incremental updates, empty for the Huffman tree of the label counts
+  std::vector<int32_t> tree_;
+
+  // data-parallel training: rank_ among nworkers_ worker processes. The
+  // training threads wait at their next sync point while pause_ is set,
+  // and mark the input rows they update in touched_.
+  int32_t rank_;
+  int32_t nworkers_;
+  std::vector<uint8_t> touched_;
+  std::atomic<bool> pause_;
+  int32_t paused_;
+  int32_t running_;
+  std::mutex pauseMutex_;
+  std::condition_variable pauseCv_;
+  std::unique_ptr<Prefetcher> prefetcher_;
+  std::unique_ptr<PrefixCache> prefixCache_;
+  std::shared_ptr<PredictionCache> predictionCache_;
+  std::shared_ptr<EarlyExit> earlyExit_;
+  std::shared_ptr<Cascade> cascade_;
+  std::shared_ptr<OutputIndex> outputIndex_;
+  std::shared_ptr<Panel> panel_;
+  void waitPause();
+  void pauseThreads();
+  void resumeThreads();
+
   void signModel(std::ostream&);
   bool checkModel(std::istream&);
 
@@ -73,13 +164,21 @@ class FastText {
   std::shared_ptr<const Dictionary> getDictionary() const;
   std::shared_ptr<const Matrix> getInputMatrix() const;
   std::shared_ptr<const Matrix> getOutputMatrix() const;
+  std::shared_ptr<const Model> getModel() const;
+  void setPredictionCache(std::shared_ptr<PredictionCache>);
+  void setEarlyExit(std::shared_ptr<EarlyExit>);
+  void setCascade(std::shared_ptr<Cascade>);
+  void setOutputIndex(std::shared_ptr<OutputIndex>);
+  void setPanel(std::shared_ptr<Panel>);
   void saveVectors();
   void saveModel(const std::string);
+  void saveModel(std::ostream&);
   void saveOutput();
   void saveModel();
   void loadModel(std::istream&);
   void loadModel(const std::string&);
   void printInfo(real, real, std::ostream&);
+  void printStats(real, std::ostream&);
 
   void supervised(
       Model&,
@@ -91,8 +190,16 @@ class FastText {
   std::vector<int32_t> selectEmbeddings(int32_t) const;
   void quantize(const Args);
   std::tuple<int64_t, double, double> test(std::istream&, std::istream&, int32_t, real = 0.0);
+  int64_t classify(std::istream&, std::istream*, std::istream*, int32_t, real,
+                   int32_t, bool, const ClassifyCallback&,
+                   const std::function<void(size_t)>& = nullptr) const;
+  void test(std::istream&, std::istream*, std::istream&, int32_t, real, int32_t,
+            bool, Evaluator&) const;
+  int64_t profile(std::istream&, std::istream*, int32_t, real, int32_t, bool,
+                  Profiler&) const;
   std::tuple<int64_t, double, double> test_paired(std::istream&, std::istream&, int32_t, real = 0.0);
   void predict(std::istream&, int32_t, bool, bool, real = 0.0);
+  void predict(std::istream&, std::istream*, int32_t, bool, real, int32_t, bool);
   void predict_paired(
     std::istream&,
     int32_t k,
@@ -104,6 +211,8 @@ class FastText {
       int32_t,
       std::vector<std::pair<real, std::string>>&,
       real = 0.0) const;
+  void predictWindows(std::istream&, int32_t, int32_t, int32_t,
+                      bool, bool, real = 0.0);
   void ngramVectors(std::string);
   void precomputeWordVectors(Matrix&);
   void findNN(
@@ -114,10 +223,13 @@ class FastText {
       std::vector<std::pair<real, std::string>>& results);
   void analogies(int32_t);
   void trainThread(int32_t);
+  void trainThreadSync(int32_t, SyncState&);
+  void trainThreadStream(int32_t, StreamState&);
   void train(const Args);
 
   void loadVectors(std::string);
   int getDimension() const;
   bool isQuant() const;
+  int32_t getRank() const;
 };
 }
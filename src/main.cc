@@ -10,8 +10,18 @@
 #include <iostream>
 #include <queue>
 #include <iomanip>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "fasttext.h"
 #include "args.h"
+#include "server.h"
+#include "simulator.h"
+#include "cascade.h"
+#include "coordinator.h"
+#include "evaluator.h"
+#include "profiler.h"
 
 using namespace fasttext;
 
@@ -24,8 +34,15 @@ void printUsage() {
     << "  test                    evaluate a supervised classifier\n"
     << "  predict                 predict most likely labels\n"
     << "  predict-prob            predict most likely labels with probabilities\n"
+    << "  predict-windows         predict most likely labels along sliding windows\n"
+    << "  predict-consensus       predict most likely labels from averaged windows\n"
+    << "  profile                 estimate the abundance of every label in a set of reads\n"
     // << "  skipgram                train a skipgram model\n"
     // << "  cbow                    train a cbow model\n"
+    << "  serve                   keep models loaded and answer requests on a socket\n"
+    << "  query                   predict most likely labels with a running server\n"
+    << "  coordinate              merge the parameters of workers training together\n"
+    << "  simulate                generate synthetic genomes and labelled reads\n"
     << "  print-word-vectors      print word vectors given a trained model\n"
     // << "  print-ngrams            print ngrams given a trained model and word\n"
     // << "  nn                      query for nearest neighbors\n"
@@ -42,25 +59,137 @@ void printQuantizeUsage() {
 
 void printTestUsage() {
   std::cerr
-    << "usage: fastdna test <model> <test-data> [<k>] [<th>]\n\n"
+    << "usage: fastdna test[-paired] <model> <test-data> <labels> [<k>] [<th>] [-thread <n>] [-mates <file>] [-average] [-taxonomy <file>] [-report <prefix>] [-cache <n>] [-exitMargin <m>] [-exitChunk <n>] [-cascade <model> -groups <file> [-shortlist <g>]] [-mips <n>] [-panel <file> [-other]]\n\n"
     << "  <model>      model filename\n"
-    << "  <test-data>  test data filename (if -, read from stdin)\n"
-    << "  <model>      test labels filename\n"
+    << "  <test-data>  test data filename\n"
+    << "  <labels>     test labels filename\n"
     << "  <k>          (optional; 1 by default) predict top k labels\n"
     << "  <th>         (optional; 0.0 by default) probability threshold\n"
+    << "  -thread      (optional; 4 by default) number of threads\n"
+    << "  -mates       (optional) second reads of the pairs, else test-paired reads interleaved pairs\n"
+    << "  -average     (optional) average the posteriors of the mates instead of pooling their k-mers\n"
+    << "  -taxonomy    (optional) ancestors of every label, tab-separated, to also evaluate higher ranks\n"
+    << "  -report      (optional) write <prefix>.tsv, <prefix>.confusion.tsv and <prefix>.json\n"
+    << "  -cache       (optional; 0 by default) predictions of up to n distinct reads cached for duplicates\n"
+    << "  -exitMargin  (optional; 0 by default) stop reading a long read once the log-probability of its best label exceeds the second by this margin, 0 to disable\n"
+    << "  -exitChunk   (optional; 500 by default) k-mers read between two checks of the margin\n"
+    << "  -cascade     (optional) coarse model of groups of labels, shortlisting the labels of the best groups\n"
+    << "  -groups      (optional) taxonomy file giving the group of every label, required with -cascade\n"
+    << "  -shortlist   (optional; 3 by default) number of groups shortlisted by -cascade\n"
+    << "  -mips        (optional; 0 by default) score only the labels of the n best of 256 clusters of the output rows, 0 to disable\n"
+    << "  -panel       (optional) file of the labels, one per line, to which predictions are restricted\n"
+    << "  -other       (optional) with -panel, the other labels compete as a single unreported label\n"
     << std::endl;
 }
 
 void printPredictUsage() {
   std::cerr
-    << "usage: fastdna predict[-prob] <model> <test-data> [<k>] [<th>]\n\n"
+    << "usage: fastdna predict[-paired][-prob] <model> <test-data> [<k>] [<th>] [-thread <n>] [-mates <file>] [-average] [-cache <n>] [-exitMargin <m>] [-exitChunk <n>] [-cascade <model> -groups <file> [-shortlist <g>]] [-mips <n>] [-panel <file> [-other]]\n\n"
+    << "  <model>      model filename\n"
+    << "  <test-data>  test data filename (if -, read from stdin)\n"
+    << "  <k>          (optional; 1 by default) predict top k labels\n"
+    << "  <th>         (optional; 0.0 by default) probability threshold\n"
+    << "  -thread      (optional; 1 by default) number of threads\n"
+    << "  -mates       (optional) second reads of the pairs, else predict-paired reads interleaved pairs\n"
+    << "  -average     (optional) average the posteriors of the mates instead of pooling their k-mers\n"
+    << "  -cache       (optional; 0 by default) predictions of up to n distinct reads cached for duplicates\n"
+    << "  -exitMargin  (optional; 0 by default) stop reading a long read once the log-probability of its best label exceeds the second by this margin, 0 to disable\n"
+    << "  -exitChunk   (optional; 500 by default) k-mers read between two checks of the margin\n"
+    << "  -cascade     (optional) coarse model of groups of labels, shortlisting the labels of the best groups\n"
+    << "  -groups      (optional) taxonomy file giving the group of every label, required with -cascade\n"
+    << "  -shortlist   (optional; 3 by default) number of groups shortlisted by -cascade\n"
+    << "  -mips        (optional; 0 by default) score only the labels of the n best of 256 clusters of the output rows, 0 to disable\n"
+    << "  -panel       (optional) file of the labels, one per line, to which predictions are restricted\n"
+    << "  -other       (optional) with -panel, the other labels compete as a single unreported label\n"
+    << std::endl;
+}
+
+void printPredictWindowsUsage() {
+  std::cerr
+    << "usage: fastdna predict-{windows,consensus}[-prob] <model> <test-data> <window> <stride> [<k>] [<th>]\n\n"
+    << "  <model>      model filename\n"
+    << "  <test-data>  test data filename (if -, read from stdin)\n"
+    << "  <window>     window length in bases\n"
+    << "  <stride>     distance between two windows in bases\n"
+    << "  <k>          (optional; 1 by default) predict top k labels\n"
+    << "  <th>         (optional; 0.0 by default) probability threshold\n"
+    << std::endl;
+}
+
+void printProfileUsage() {
+  std::cerr
+    << "usage: fastdna profile <model> <reads> <output> [-k <k>] [-threshold <th>] [-thread <n>] [-em <iterations>] [-mates <file>] [-average] [-cache <n>] [-exitMargin <m>] [-exitChunk <n>] [-cascade <model> -groups <file> [-shortlist <g>]] [-mips <n>] [-panel <file> [-other]]\n\n"
     << "  <model>      model filename\n"
+    << "  <reads>      reads filename (if -, read from stdin)\n"
+    << "  <output>     abundance table filename (if -, write to stdout)\n"
+    << "  -k           (optional; 5 by default) number of labels kept per read\n"
+    << "  -threshold   (optional; 0.0 by default) probability threshold\n"
+    << "  -thread      (optional; 4 by default) number of threads\n"
+    << "  -em          (optional; 0 by default) maximal number of EM iterations, 0 to sum probabilities\n"
+    << "  -mates       (optional) second reads of the pairs\n"
+    << "  -average     (optional) average the posteriors of the mates instead of pooling their k-mers\n"
+    << "  -cache       (optional; 0 by default) predictions of up to n distinct reads cached for duplicates\n"
+    << "  -exitMargin  (optional; 0 by default) stop reading a long read once the log-probability of its best label exceeds the second by this margin, 0 to disable\n"
+    << "  -exitChunk   (optional; 500 by default) k-mers read between two checks of the margin\n"
+    << "  -cascade     (optional) coarse model of groups of labels, shortlisting the labels of the best groups\n"
+    << "  -groups      (optional) taxonomy file giving the group of every label, required with -cascade\n"
+    << "  -shortlist   (optional; 3 by default) number of groups shortlisted by -cascade\n"
+    << "  -mips        (optional; 0 by default) score only the labels of the n best of 256 clusters of the output rows, 0 to disable\n"
+    << "  -panel       (optional) file of the labels, one per line, to which predictions are restricted\n"
+    << "  -other       (optional) with -panel, the other labels compete as a single unreported label\n"
+    << std::endl;
+}
+
+void printServeUsage() {
+  std::cerr
+    << "usage: fastdna serve <address> <model> [<model> ...] [-thread <n>] [-batch <n>] [-delay <us>] [-maxLine <n>]\n\n"
+    << "  <address>    Unix socket path, or port number for localhost TCP\n"
+    << "  <model>      model filename, or <name>=<filename>\n"
+    << "  -thread      (optional; 4 by default) number of batching threads\n"
+    << "  -batch       (optional; 64 by default) maximal number of reads per batch\n"
+    << "  -delay       (optional; 2000 by default) maximal wait for a batch, in microseconds\n"
+    << "  -maxLine     (optional; 67108864 by default) maximal length of a request, in bytes\n"
+    << std::endl;
+}
+
+void printQueryUsage() {
+  std::cerr
+    << "usage: fastdna query[-prob] <address> <model> <test-data> [<k>] [<th>]\n\n"
+    << "  <address>    address of a running fastdna server\n"
+    << "  <model>      name of a model loaded by the server\n"
     << "  <test-data>  test data filename (if -, read from stdin)\n"
     << "  <k>          (optional; 1 by default) predict top k labels\n"
     << "  <th>         (optional; 0.0 by default) probability threshold\n"
     << std::endl;
 }
 
+void printCoordinateUsage() {
+  std::cerr
+    << "usage: fastdna coordinate <address> <workers>\n\n"
+    << "  <address>    Unix socket path, or port number for localhost TCP\n"
+    << "  <workers>    number of workers, started with -coordinator <address>\n"
+    << std::endl;
+}
+
+void printSimulateUsage() {
+  std::cerr
+    << "usage: fastdna simulate <output> [<option> <value> ...]\n\n"
+    << "  <output>         prefix of the output files\n"
+    << "  -genomes         (optional; 100 by default) number of genomes\n"
+    << "  -clades          (optional; 10 by default) number of clades, genomes of a clade share an ancestor\n"
+    << "  -genomeLength    (optional; 100000 by default) median genome length\n"
+    << "  -lengthSigma     (optional; 0.3 by default) log-normal spread of genome lengths\n"
+    << "  -order           (optional; 0 by default) order of the Markov chain of ancestors\n"
+    << "  -divergence      (optional; 0.05 by default) substitution rate between a genome and its ancestor, below 1\n"
+    << "  -abundanceSigma  (optional; 0 by default) log-normal spread of genome abundances\n"
+    << "  -reads           (optional; 1000000 by default) number of reads\n"
+    << "  -readLength      (optional; 200 by default) read length\n"
+    << "  -noise           (optional; 0 by default) mutation rate of reads (/100,000), below 100,000\n"
+    << "  -thread          (optional; 4 by default) number of threads\n"
+    << "  -seed            (optional; 0 by default) random seed\n"
+    << std::endl;
+}
+
 void printPrintWordVectorsUsage() {
   std::cerr
     << "usage: fastdna print-word-vectors <model>\n\n"
@@ -116,57 +245,346 @@ void printDumpUsage() {
     << std::endl;
 }
 
+// Mates of paired reads: read from filename if given, else interleaved
+// in reads if paired
+std::istream* openMates(std::istream& reads,
+                        const std::string& filename,
+                        bool paired,
+                        std::ifstream& file) {
+  if (filename.empty()) {
+    return paired ? &reads : nullptr;
+  }
+  file.open(filename);
+  if (!file.is_open()) {
+    std::cerr << "Mates file cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return &file;
+}
+
+// Prediction cache of entries reads, none if entries is 0
+std::shared_ptr<PredictionCache> setPredictionCache(FastText& fasttext,
+                                                    int64_t entries) {
+  std::shared_ptr<PredictionCache> cache;
+  if (entries > 0) {
+    cache = std::make_shared<PredictionCache>(entries);
+    fasttext.setPredictionCache(cache);
+  }
+  return cache;
+}
+
+void printCacheStats(const std::shared_ptr<PredictionCache>& cache) {
+  if (!cache) {
+    return;
+  }
+  const int64_t lookups = cache->hits() + cache->misses();
+  std::cerr << "Prediction cache: " << lookups << " lookups, hit rate "
+            << std::fixed << std::setprecision(1)
+            << (lookups > 0 ? 100.0 * cache->hits() / lookups : 0.0) << "%"
+            << std::defaultfloat << std::endl;
+}
+
+// Early exit of long reads, none if margin is 0
+std::shared_ptr<EarlyExit> setEarlyExit(FastText& fasttext,
+                                        real margin,
+                                        int64_t chunk) {
+  std::shared_ptr<EarlyExit> earlyExit;
+  if (margin > 0) {
+    if (chunk <= 0) {
+      std::cerr << "The early exit chunk needs to be positive!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    earlyExit = std::make_shared<EarlyExit>(margin, chunk);
+    fasttext.setEarlyExit(earlyExit);
+  }
+  return earlyExit;
+}
+
+void printEarlyExitStats(const std::shared_ptr<EarlyExit>& earlyExit) {
+  if (!earlyExit || earlyExit->reads == 0) {
+    return;
+  }
+  const double reads = earlyExit->reads;
+  std::cerr << "Early exit: " << earlyExit->exited << " of " << earlyExit->reads
+            << " long reads, " << std::fixed << std::setprecision(1)
+            << earlyExit->consumed / reads << " of " << earlyExit->kmers / reads
+            << " k-mers consumed per read" << std::defaultfloat << std::endl;
+}
+
+// Cascade of a coarse model, none if coarseFile is empty
+std::shared_ptr<Cascade> setCascade(FastText& fasttext,
+                                    const std::string& coarseFile,
+                                    const std::string& groupsFile,
+                                    int32_t shortlist) {
+  std::shared_ptr<Cascade> cascade;
+  if (coarseFile.empty()) {
+    return cascade;
+  }
+  if (groupsFile.empty()) {
+    std::cerr << "-cascade needs the -groups of the labels!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  auto coarse = std::make_shared<FastText>();
+  coarse->loadModel(coarseFile);
+  Taxonomy taxonomy(groupsFile, *fasttext.getDictionary());
+  cascade = std::make_shared<Cascade>(
+      coarse, taxonomy, *fasttext.getDictionary(), shortlist);
+  fasttext.setCascade(cascade);
+  return cascade;
+}
+
+void printCascadeStats(const std::shared_ptr<Cascade>& cascade) {
+  if (!cascade || cascade->reads() == 0) {
+    return;
+  }
+  std::cerr << "Cascade: " << std::fixed << std::setprecision(1)
+            << double(cascade->shortlisted()) / cascade->reads() << " of "
+            << cascade->nlabels() << " labels shortlisted per read"
+            << std::defaultfloat << std::endl;
+}
+
+// Index of the output rows probing nprobe lists, none if nprobe is 0
+std::shared_ptr<OutputIndex> setOutputIndex(FastText& fasttext,
+                                            int32_t nprobe) {
+  std::shared_ptr<OutputIndex> index;
+  if (nprobe <= 0) {
+    return index;
+  }
+  const Args args = fasttext.getArgs();
+  auto output = fasttext.getOutputMatrix();
+  if (args.loss == loss_name::hs ||
+      output->size(0) != fasttext.getDictionary()->nlabels()) {
+    std::cerr << "-mips needs a model without hierarchical softmax nor quantized output!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  index = std::make_shared<OutputIndex>(*output, nprobe);
+  fasttext.setOutputIndex(index);
+  return index;
+}
+
+void printOutputIndexStats(const std::shared_ptr<OutputIndex>& index) {
+  if (!index || index->reads() == 0) {
+    return;
+  }
+  std::cerr << "Output index: " << std::fixed << std::setprecision(1)
+            << double(index->candidates()) / index->reads() << " of "
+            << index->nlabels() << " labels scored per read"
+            << std::defaultfloat << std::endl;
+}
+
+// Panel of the labels of panelFile, none if panelFile is empty
+std::shared_ptr<Panel> setPanel(FastText& fasttext,
+                                const std::string& panelFile,
+                                bool other) {
+  std::shared_ptr<Panel> panel;
+  if (panelFile.empty()) {
+    return panel;
+  }
+  const Args args = fasttext.getArgs();
+  auto output = fasttext.getOutputMatrix();
+  if (args.loss == loss_name::hs ||
+      output->size(0) != fasttext.getDictionary()->nlabels()) {
+    std::cerr << "-panel needs a model without hierarchical softmax nor quantized output!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  panel = std::make_shared<Panel>(
+      panelFile, *fasttext.getDictionary(), *output, other);
+  fasttext.setPanel(panel);
+  return panel;
+}
+
+void printPanelStats(const std::shared_ptr<Panel>& panel) {
+  if (!panel || panel->reads() == 0) {
+    return;
+  }
+  std::cerr << "Panel: " << panel->size() << " of " << panel->nlabels()
+            << " labels, " << panel->others() << " of " << panel->reads()
+            << " reads outside the panel" << std::endl;
+}
+
+// -cascade, -mips and -panel each replace the softmax over all labels,
+// which -exitMargin and -average compute on their own
+void checkRestrictions(const std::string& coarseFile,
+                       int32_t nprobe,
+                       const std::string& panelFile,
+                       real exitMargin,
+                       bool average) {
+  if (!coarseFile.empty() + (nprobe > 0) + !panelFile.empty() > 1) {
+    std::cerr << "-cascade, -mips and -panel cannot be combined!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if ((!coarseFile.empty() || nprobe > 0 || !panelFile.empty()) &&
+      (exitMargin > 0 || average)) {
+    std::cerr << "-cascade, -mips and -panel cannot be combined with -exitMargin nor -average!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
 void test(const std::vector<std::string>& args) {
-  if (args.size() < 5 || args.size() > 7) {
+  std::vector<std::string> positional;
+  int32_t thread = 4;
+  int64_t cacheEntries = 0, exitChunk = 500;
+  real exitMargin = 0.0;
+  std::string coarseFile, groupsFile, panelFile;
+  bool other = false;
+  int32_t shortlist = 3, nprobe = 0;
+  std::string taxonomyFile, report, matesFile;
+  bool average = false;
+  for (size_t ai = 2; ai < args.size(); ai++) {
+    if (args[ai] == "-thread" && ai + 1 < args.size()) {
+      thread = std::stoi(args[++ai]);
+    } else if (args[ai] == "-mates" && ai + 1 < args.size()) {
+      matesFile = args[++ai];
+    } else if (args[ai] == "-average") {
+      average = true;
+    } else if (args[ai] == "-taxonomy" && ai + 1 < args.size()) {
+      taxonomyFile = args[++ai];
+    } else if (args[ai] == "-report" && ai + 1 < args.size()) {
+      report = args[++ai];
+    } else if (args[ai] == "-cache" && ai + 1 < args.size()) {
+      cacheEntries = std::stoll(args[++ai]);
+    } else if (args[ai] == "-exitMargin" && ai + 1 < args.size()) {
+      exitMargin = std::stof(args[++ai]);
+    } else if (args[ai] == "-exitChunk" && ai + 1 < args.size()) {
+      exitChunk = std::stoll(args[++ai]);
+    } else if (args[ai] == "-cascade" && ai + 1 < args.size()) {
+      coarseFile = args[++ai];
+    } else if (args[ai] == "-groups" && ai + 1 < args.size()) {
+      groupsFile = args[++ai];
+    } else if (args[ai] == "-shortlist" && ai + 1 < args.size()) {
+      shortlist = std::stoi(args[++ai]);
+    } else if (args[ai] == "-mips" && ai + 1 < args.size()) {
+      nprobe = std::stoi(args[++ai]);
+    } else if (args[ai] == "-panel" && ai + 1 < args.size()) {
+      panelFile = args[++ai];
+    } else if (args[ai] == "-other") {
+      other = true;
+    } else if (args[ai].size() > 1 && args[ai][0] == '-' && !isdigit(args[ai][1])) {
+      printTestUsage();
+      exit(EXIT_FAILURE);
+    } else {
+      positional.push_back(args[ai]);
+    }
+  }
+  if (positional.size() < 3 || positional.size() > 5) {
     printTestUsage();
     exit(EXIT_FAILURE);
   }
   int32_t k = 1;
   real threshold = 0.0;
-  if (args.size() > 5) {
-    k = std::stoi(args[5]);
-    if (args.size() == 7) {
-      threshold = std::stof(args[6]);
+  if (positional.size() > 3) {
+    k = std::stoi(positional[3]);
+    if (positional.size() == 5) {
+      threshold = std::stof(positional[4]);
     }
   }
   bool paired_end = args[1] == "test-paired";
   FastText fasttext;
-  // std::cerr << "Loading Model" << std::endl;
-  fasttext.loadModel(args[2]);
-  // std::cerr << "Model Loaded" << std::endl;
+  fasttext.loadModel(positional[0]);
 
-  std::tuple<int64_t, double, double> result;
-  std::string infile = args[3];
-  std::string labelfile = args[4];
-  if (infile == "-") {
-    // result = fasttext.test(std::cin, k, threshold);
-  } else {
-    std::ifstream ifs(infile);
-    if (!ifs.is_open()) {
-      std::cerr << "Test file cannot be opened!" << std::endl;
-      exit(EXIT_FAILURE);
-    }
-    std::ifstream labels(labelfile);
-    if (!ifs.is_open()) {
-      std::cerr << "Label file cannot be opened!" << std::endl;
+  std::string infile = positional[1];
+  std::string labelfile = positional[2];
+  std::ifstream ifs(infile);
+  if (!ifs.is_open()) {
+    std::cerr << "Test file cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::ifstream labels(labelfile);
+  if (!labels.is_open()) {
+    std::cerr << "Label file cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::shared_ptr<const Taxonomy> taxonomy;
+  if (!taxonomyFile.empty()) {
+    taxonomy = std::make_shared<Taxonomy>(taxonomyFile, *fasttext.getDictionary());
+  }
+  std::ifstream matesStream;
+  std::istream* mates = openMates(ifs, matesFile, paired_end, matesStream);
+  auto cache = setPredictionCache(fasttext, cacheEntries);
+  checkRestrictions(coarseFile, nprobe, panelFile, exitMargin, average);
+  auto earlyExit = setEarlyExit(fasttext, exitMargin, exitChunk);
+  auto cascade = setCascade(fasttext, coarseFile, groupsFile, shortlist);
+  auto outputIndex = setOutputIndex(fasttext, nprobe);
+  auto panel = setPanel(fasttext, panelFile, other);
+  Evaluator evaluator(*fasttext.getDictionary(), taxonomy);
+  fasttext.test(ifs, mates, labels, k, threshold, thread, average, evaluator);
+  ifs.close();
+
+  std::cout << "N" << "\t" << evaluator.nexamples() << std::endl;
+  std::cout << std::setprecision(3);
+  std::cout << "P@" << k << "\t" << evaluator.precision() << std::endl;
+  std::cout << "R@" << k << "\t" << evaluator.recall() << std::endl;
+  for (int32_t l = 1; l < evaluator.nlevels(); l++) {
+    std::cout << "P@" << k << " " << evaluator.rank(l) << "\t"
+              << evaluator.precision(l) << std::endl;
+    std::cout << "R@" << k << " " << evaluator.rank(l) << "\t"
+              << evaluator.recall(l) << std::endl;
+  }
+  std::cerr << "Number of examples: " << evaluator.nexamples() << std::endl;
+  printCacheStats(cache);
+  printEarlyExitStats(earlyExit);
+  printCascadeStats(cascade);
+  printOutputIndexStats(outputIndex);
+  printPanelStats(panel);
+  if (!report.empty()) {
+    std::ofstream tsv(report + ".tsv"), confusion(report + ".confusion.tsv"),
+      json(report + ".json");
+    if (!tsv.is_open() || !confusion.is_open() || !json.is_open()) {
+      std::cerr << "Report files cannot be opened!" << std::endl;
       exit(EXIT_FAILURE);
     }
-    if (paired_end) {
-      result = fasttext.test_paired(ifs, labels, k, threshold);
-    } else {
-      result = fasttext.test(ifs, labels, k, threshold);
-    }
-    ifs.close();
+    evaluator.writeLabels(tsv);
+    evaluator.writeConfusion(confusion);
+    evaluator.writeSummary(json);
   }
-  std::cout << "N" << "\t" << std::get<0>(result) << std::endl;
-  std::cout << std::setprecision(3);
-  std::cout << "P@" << k << "\t" << std::get<1>(result) << std::endl;
-  std::cout << "R@" << k << "\t" << std::get<2>(result) << std::endl;
-  std::cerr << "Number of examples: " << std::get<0>(result) << std::endl;
 }
 
 void predict(const std::vector<std::string>& args) {
-  if (args.size() < 4 || args.size() > 6) {
+  std::vector<std::string> positional;
+  int32_t thread = 1;
+  int64_t cacheEntries = 0, exitChunk = 500;
+  real exitMargin = 0.0;
+  std::string coarseFile, groupsFile, panelFile;
+  bool other = false;
+  int32_t shortlist = 3, nprobe = 0;
+  std::string matesFile;
+  bool average = false;
+  for (size_t ai = 2; ai < args.size(); ai++) {
+    if (args[ai] == "-thread" && ai + 1 < args.size()) {
+      thread = std::stoi(args[++ai]);
+    } else if (args[ai] == "-mates" && ai + 1 < args.size()) {
+      matesFile = args[++ai];
+    } else if (args[ai] == "-average") {
+      average = true;
+    } else if (args[ai] == "-cache" && ai + 1 < args.size()) {
+      cacheEntries = std::stoll(args[++ai]);
+    } else if (args[ai] == "-exitMargin" && ai + 1 < args.size()) {
+      exitMargin = std::stof(args[++ai]);
+    } else if (args[ai] == "-exitChunk" && ai + 1 < args.size()) {
+      exitChunk = std::stoll(args[++ai]);
+    } else if (args[ai] == "-cascade" && ai + 1 < args.size()) {
+      coarseFile = args[++ai];
+    } else if (args[ai] == "-groups" && ai + 1 < args.size()) {
+      groupsFile = args[++ai];
+    } else if (args[ai] == "-shortlist" && ai + 1 < args.size()) {
+      shortlist = std::stoi(args[++ai]);
+    } else if (args[ai] == "-mips" && ai + 1 < args.size()) {
+      nprobe = std::stoi(args[++ai]);
+    } else if (args[ai] == "-panel" && ai + 1 < args.size()) {
+      panelFile = args[++ai];
+    } else if (args[ai] == "-other") {
+      other = true;
+    } else if (args[ai].size() > 1 && args[ai][0] == '-' && !isdigit(args[ai][1])) {
+      printPredictUsage();
+      exit(EXIT_FAILURE);
+    } else {
+      positional.push_back(args[ai]);
+    }
+  }
+  if (positional.size() < 2 || positional.size() > 4) {
     printPredictUsage();
     exit(EXIT_FAILURE);
   }
@@ -174,33 +592,342 @@ void predict(const std::vector<std::string>& args) {
   real threshold = 0.0;
   bool paired_end = (args[1] == "predict-paired" || args[1] == "predict-paired-prob");
 
-  if (args.size() > 4) {
-    k = std::stoi(args[4]);
-    if (args.size() == 6) {
-      threshold = std::stof(args[5]);
+  if (positional.size() > 2) {
+    k = std::stoi(positional[2]);
+    if (positional.size() == 4) {
+      threshold = std::stof(positional[3]);
     }
   }
 
   bool print_prob = (args[1] == "predict-prob" || args[1] == "predict-paired-prob");
   FastText fasttext;
+  fasttext.loadModel(positional[0]);
+
+  std::string infile(positional[1]);
+  std::ifstream ifs;
+  if (infile != "-") {
+    ifs.open(infile);
+    if (!ifs.is_open()) {
+      std::cerr << "Input file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  std::istream& in = infile == "-" ? std::cin : ifs;
+  std::ifstream matesStream;
+  std::istream* mates = openMates(in, matesFile, paired_end, matesStream);
+  auto cache = setPredictionCache(fasttext, cacheEntries);
+  checkRestrictions(coarseFile, nprobe, panelFile, exitMargin, average);
+  auto earlyExit = setEarlyExit(fasttext, exitMargin, exitChunk);
+  auto cascade = setCascade(fasttext, coarseFile, groupsFile, shortlist);
+  auto outputIndex = setOutputIndex(fasttext, nprobe);
+  auto panel = setPanel(fasttext, panelFile, other);
+  fasttext.predict(in, mates, k, print_prob, threshold, thread, average);
+  printCacheStats(cache);
+  printEarlyExitStats(earlyExit);
+  printCascadeStats(cascade);
+  printOutputIndexStats(outputIndex);
+  printPanelStats(panel);
+
+  exit(0);
+}
+
+void predictWindows(const std::vector<std::string>& args) {
+  if (args.size() < 6 || args.size() > 8) {
+    printPredictWindowsUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t k = 1;
+  real threshold = 0.0;
+  int32_t window = std::stoi(args[4]);
+  int32_t stride = std::stoi(args[5]);
+  if (args.size() > 6) {
+    k = std::stoi(args[6]);
+    if (args.size() == 8) {
+      threshold = std::stof(args[7]);
+    }
+  }
+
+  bool consensus = (args[1] == "predict-consensus" || args[1] == "predict-consensus-prob");
+  bool print_prob = (args[1] == "predict-windows-prob" || args[1] == "predict-consensus-prob");
+  FastText fasttext;
   fasttext.loadModel(std::string(args[2]));
 
   std::string infile(args[3]);
   if (infile == "-") {
-    fasttext.predict(std::cin, k, paired_end, print_prob, threshold);
+    fasttext.predictWindows(std::cin, window, stride, k, consensus, print_prob, threshold);
   } else {
     std::ifstream ifs(infile);
     if (!ifs.is_open()) {
       std::cerr << "Input file cannot be opened!" << std::endl;
       exit(EXIT_FAILURE);
     }
-    fasttext.predict(ifs, k, paired_end, print_prob, threshold);
+    fasttext.predictWindows(ifs, window, stride, k, consensus, print_prob, threshold);
     ifs.close();
   }
 
   exit(0);
 }
 
+void profile(const std::vector<std::string>& args) {
+  if (args.size() < 5) {
+    printProfileUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t k = 5, thread = 4, iterations = 0;
+  int64_t cacheEntries = 0, exitChunk = 500;
+  real exitMargin = 0.0;
+  std::string coarseFile, groupsFile, panelFile;
+  bool other = false;
+  int32_t shortlist = 3, nprobe = 0;
+  real threshold = 0.0;
+  std::string matesFile;
+  bool average = false;
+  for (size_t ai = 5; ai < args.size(); ai++) {
+    if (args[ai] == "-average") {
+      average = true;
+    } else if (args[ai] == "-other") {
+      other = true;
+    } else if (ai + 1 == args.size()) {
+      printProfileUsage();
+      exit(EXIT_FAILURE);
+    } else if (args[ai] == "-k") {
+      k = std::stoi(args[++ai]);
+    } else if (args[ai] == "-threshold") {
+      threshold = std::stof(args[++ai]);
+    } else if (args[ai] == "-thread") {
+      thread = std::stoi(args[++ai]);
+    } else if (args[ai] == "-em") {
+      iterations = std::stoi(args[++ai]);
+    } else if (args[ai] == "-mates") {
+      matesFile = args[++ai];
+    } else if (args[ai] == "-cache") {
+      cacheEntries = std::stoll(args[++ai]);
+    } else if (args[ai] == "-exitMargin") {
+      exitMargin = std::stof(args[++ai]);
+    } else if (args[ai] == "-exitChunk") {
+      exitChunk = std::stoll(args[++ai]);
+    } else if (args[ai] == "-cascade") {
+      coarseFile = args[++ai];
+    } else if (args[ai] == "-groups") {
+      groupsFile = args[++ai];
+    } else if (args[ai] == "-shortlist") {
+      shortlist = std::stoi(args[++ai]);
+    } else if (args[ai] == "-mips") {
+      nprobe = std::stoi(args[++ai]);
+    } else if (args[ai] == "-panel") {
+      panelFile = args[++ai];
+    } else {
+      printProfileUsage();
+      exit(EXIT_FAILURE);
+    }
+  }
+  FastText fasttext;
+  fasttext.loadModel(args[2]);
+  auto dict = fasttext.getDictionary();
+  Profiler profiler(dict->nlabels());
+  std::ifstream ifs;
+  if (args[3] != "-") {
+    ifs.open(args[3]);
+    if (!ifs.is_open()) {
+      std::cerr << "Input file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  std::istream& in = args[3] == "-" ? std::cin : ifs;
+  std::ifstream matesStream;
+  std::istream* mates = openMates(in, matesFile, false, matesStream);
+  auto cache = setPredictionCache(fasttext, cacheEntries);
+  checkRestrictions(coarseFile, nprobe, panelFile, exitMargin, average);
+  auto earlyExit = setEarlyExit(fasttext, exitMargin, exitChunk);
+  auto cascade = setCascade(fasttext, coarseFile, groupsFile, shortlist);
+  auto outputIndex = setOutputIndex(fasttext, nprobe);
+  auto panel = setPanel(fasttext, panelFile, other);
+  const int64_t nreads =
+    fasttext.profile(in, mates, k, threshold, thread, average, profiler);
+  std::cerr << "Reads: " << nreads << ", classified: " << profiler.classified()
+            << ", equivalence classes: " << profiler.nclasses() << std::endl;
+  printCacheStats(cache);
+  printEarlyExitStats(earlyExit);
+  printCascadeStats(cascade);
+  printOutputIndexStats(outputIndex);
+  printPanelStats(panel);
+  std::vector<double> abundances = iterations > 0 ?
+    profiler.em(dict->getLabelCounts(), iterations) : profiler.abundances();
+  if (args[4] == "-") {
+    profiler.write(std::cout, *dict, abundances);
+  } else {
+    std::ofstream ofs(args[4]);
+    if (!ofs.is_open()) {
+      std::cerr << "Output file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    profiler.write(ofs, *dict, abundances);
+  }
+  exit(0);
+}
+
+void coordinate(const std::vector<std::string>& args) {
+  if (args.size() != 4) {
+    printCoordinateUsage();
+    exit(EXIT_FAILURE);
+  }
+  Coordinator coordinator(std::stoi(args[3]));
+  coordinator.serve(args[2]);
+  exit(0);
+}
+
+void serve(const std::vector<std::string>& args) {
+  if (args.size() < 4) {
+    printServeUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t thread = 4, batch = 64, delay = 2000;
+  int64_t maxLine = 67108864;
+  std::vector<std::string> models;
+  for (int ai = 3; ai < args.size(); ai++) {
+    if (args[ai][0] != '-') {
+      models.push_back(args[ai]);
+      continue;
+    }
+    if (ai + 1 >= args.size()) {
+      printServeUsage();
+      exit(EXIT_FAILURE);
+    }
+    if (args[ai] == "-thread") {
+      thread = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-batch") {
+      batch = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-delay") {
+      delay = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-maxLine") {
+      maxLine = std::stoll(args[ai + 1]);
+    } else {
+      printServeUsage();
+      exit(EXIT_FAILURE);
+    }
+    ai++;
+  }
+  Server server(thread, batch, delay, maxLine);
+  for (auto it = models.cbegin(); it != models.cend(); ++it) {
+    size_t eq = it->find('=');
+    if (eq == std::string::npos) {
+      server.addModel(*it, *it);
+    } else {
+      server.addModel(it->substr(0, eq), it->substr(eq + 1));
+    }
+  }
+  server.serve(args[2]);
+  exit(0);
+}
+
+void simulate(const std::vector<std::string>& args) {
+  if (args.size() < 3 || args.size() % 2 == 0 || args[2][0] == '-') {
+    printSimulateUsage();
+    exit(EXIT_FAILURE);
+  }
+  Simulator simulator;
+  for (int ai = 3; ai < args.size(); ai += 2) {
+    if (args[ai] == "-genomes") {
+      simulator.ngenomes = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-clades") {
+      simulator.nclades = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-genomeLength") {
+      simulator.genomeLength = std::stoll(args[ai + 1]);
+    } else if (args[ai] == "-lengthSigma") {
+      simulator.lengthSigma = std::stod(args[ai + 1]);
+    } else if (args[ai] == "-order") {
+      simulator.order = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-divergence") {
+      simulator.divergence = std::stod(args[ai + 1]);
+    } else if (args[ai] == "-abundanceSigma") {
+      simulator.abundanceSigma = std::stod(args[ai + 1]);
+    } else if (args[ai] == "-reads") {
+      simulator.nreads = std::stoll(args[ai + 1]);
+    } else if (args[ai] == "-readLength") {
+      simulator.readLength = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-noise") {
+      simulator.noise = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-thread") {
+      simulator.thread = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-seed") {
+      simulator.seed = std::stoul(args[ai + 1]);
+    } else {
+      std::cerr << "Unknown argument: " << args[ai] << std::endl;
+      printSimulateUsage();
+      exit(EXIT_FAILURE);
+    }
+  }
+  simulator.simulate(args[2]);
+  exit(0);
+}
+
+void query(const std::vector<std::string>& args) {
+  if (args.size() < 5 || args.size() > 7) {
+    printQueryUsage();
+    exit(EXIT_FAILURE);
+  }
+  std::string k = "1", threshold = "0";
+  if (args.size() > 5) {
+    k = args[5];
+    if (args.size() == 7) {
+      threshold = args[6];
+    }
+  }
+  bool print_prob = (args[1] == "query-prob");
+  std::ifstream ifs;
+  if (args[4] != "-") {
+    ifs.open(args[4]);
+    if (!ifs.is_open()) {
+      std::cerr << "Input file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  std::istream& in = (args[4] == "-") ? std::cin : ifs;
+  int fd = Server::connect(args[2]);
+
+  // one request per sequence, sent while the replies are read
+  std::thread sender([&]() {
+    const std::string prefix = "predict " + args[3] + " " + k + " " + threshold + " ";
+    std::string line, request;
+    while (std::getline(in, line)) {
+      if (!line.empty() && line[0] == Dictionary::BOS) {
+        if (!request.empty()) {
+          Server::writeAll(fd, request + "\n");
+        }
+        request = prefix;
+      } else {
+        if (request.empty()) {
+          request = prefix;
+        }
+        request += line;
+      }
+    }
+    if (!request.empty()) {
+      Server::writeAll(fd, request + "\n");
+    }
+    shutdown(fd, SHUT_WR);
+  });
+
+  std::string buffer, reply;
+  while (Server::readLine(fd, buffer, reply)) {
+    if (print_prob) {
+      std::cout << reply << std::endl;
+      continue;
+    }
+    std::istringstream iss(reply);
+    std::string label, prob;
+    bool first = true;
+    while (iss >> label >> prob) {
+      std::cout << (first ? "" : " ") << label;
+      first = false;
+    }
+    std::cout << std::endl;
+  }
+  sender.join();
+  close(fd);
+  exit(0);
+}
+
 void printWordVectors(const std::vector<std::string> args) {
   if (args.size() != 3) {
     printPrintWordVectorsUsage();
@@ -290,6 +1017,10 @@ void train(const std::vector<std::string> args) {
   }
   ofs.close();
   fasttext.train(a);
+  if (fasttext.getRank() > 0) {
+    // all workers end with the same model, saved by the first one
+    return;
+  }
   fasttext.saveModel();
   fasttext.saveVectors();
   if (a.saveOutput) {
@@ -354,6 +1085,19 @@ int main(int argc, char** argv) {
   } else if (command == "predict" || command == "predict-prob" ||
              command == "predict-paired" || command == "predict-paired-prob") {
     predict(args);
+  } else if (command == "predict-windows" || command == "predict-windows-prob" ||
+             command == "predict-consensus" || command == "predict-consensus-prob") {
+    predictWindows(args);
+  } else if (command == "serve") {
+    serve(args);
+  } else if (command == "profile") {
+    profile(args);
+  } else if (command == "coordinate") {
+    coordinate(args);
+  } else if (command == "simulate") {
+    simulate(args);
+  } else if (command == "query" || command == "query-prob") {
+    query(args);
   } else if (command == "dump") {
     dump(args);
   } else {
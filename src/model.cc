@@ -10,8 +10,10 @@
 #include "model.h"
 
 #include <iostream>
+#include <chrono>
 #include <assert.h>
 #include <algorithm>
+#include <limits>
 #include <stdexcept>
 
 namespace fasttext {
@@ -38,6 +40,11 @@ Model::Model(
   negpos = 0;
   loss_ = 0.0;
   nexamples_ = 1;
+  timed_ = false;
+  forwardTime_ = 0;
+  backwardTime_ = 0;
+  inputGradients_ = nullptr;
+  touchedRows_ = nullptr;
   t_sigmoid_.reserve(SIGMOID_TABLE_SIZE + 1);
   t_log_.reserve(LOG_TABLE_SIZE + 1);
   initSigmoid();
@@ -81,10 +88,8 @@ real Model::negativeSampling(int32_t target, real lr) {
 real Model::hierarchicalSoftmax(int32_t target, real lr) {
   real loss = 0.0;
   grad_.zero();
-  const std::vector<bool>& binaryCode = codes[target];
-  const std::vector<int32_t>& pathToRoot = paths[target];
-  for (int32_t i = 0; i < pathToRoot.size(); i++) {
-    loss += binaryLogistic(pathToRoot[i], binaryCode[i], lr);
+  for (int32_t i = pathOffsets_[target]; i < pathOffsets_[target + 1]; i++) {
+    loss += binaryLogistic(pathRows_[i], pathCodes_[i], lr);
   }
   return loss;
 }
@@ -95,6 +100,10 @@ void Model::computeOutputSoftmax(Vector& hidden, Vector& output) const {
   } else {
     output.mul(*wo_, hidden);
   }
+  normalizeSoftmax(output);
+}
+
+void Model::normalizeSoftmax(Vector& output) const {
   real max = output[0], z = 0.0;
   for (int32_t i = 0; i < osz_; i++) {
     max = std::max(output[i], max);
@@ -154,7 +163,7 @@ void Model::predict(const std::vector<index>& input, int32_t k, real threshold,
   heap.reserve(k + 1);
   computeHidden(input, hidden);
   if (args_->loss == loss_name::hs) {
-    dfs(k, threshold, 2 * osz_ - 2, 0.0, heap, hidden);
+    treeSearch(k, threshold, heap, hidden);
   } else {
     computeOutputSoftmax(hidden, output);
     findKBest(k, threshold, heap, output);
@@ -162,6 +171,9 @@ void Model::predict(const std::vector<index>& input, int32_t k, real threshold,
   std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
+// Averages the posteriors of two mates, a mate without k-mers is ignored.
+// With hierarchical softmax, only the k best labels of each mate are known
+// and a label missing from the k best of a mate counts as 0 for it.
 void Model::predict_paired(
   const std::vector<index>& input, const std::vector<index>& input2,
   int32_t k, real threshold,
@@ -173,22 +185,97 @@ void Model::predict_paired(
   if (args_->model != model_name::sup) {
     throw std::invalid_argument("Model needs to be supervised for prediction!");
   }
+  heap.clear();
+  if (input.empty() || input2.empty()) {
+    predict(input.empty() ? input2 : input, k, threshold, heap, hidden, output);
+    return;
+  }
   heap.reserve(k + 1);
   computeHidden(input, hidden);
   computeHidden(input2, hidden2);
   if (args_->loss == loss_name::hs) {
-    throw std::invalid_argument("Paired end predictions are not implemented with hierarchical softmax loss.");
-    // dfs(k, threshold, 2 * osz_ - 2, 0.0, heap, hidden);
+    output.zero();
+    for (Vector* h : {&hidden, &hidden2}) {
+      heap.clear();
+      treeSearch(k, 0.0, heap, *h);
+      for (auto it = heap.cbegin(); it != heap.cend(); ++it) {
+        output[it->second] += 0.5 * std::exp(it->first);
+      }
+    }
+    heap.clear();
   } else {
     computeOutputSoftmax(hidden, output);
     computeOutputSoftmax(hidden2, output2);
     output.addVector(output2);
     output.mul(0.5);
-    findKBest(k, threshold, heap, output);
   }
+  findKBest(k, threshold, heap, output);
   std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
+/*
+Early exit
+The hidden vector of a long read is the mean of many embeddings, and its
+first k-mers often suffice to decide the label. The embeddings are added
+by chunks of chunk k-mers; after every chunk, the running mean is scored
+and if the log-probability of the best label exceeds that of the second
+by margin, the remaining k-mers are skipped. Returns the number of k-mers
+consumed. A chunk costs chunk additions of rows against one scoring of
+the whole output layer, so chunk should not be much smaller than the
+number of labels.
+*/
+int64_t Model::predictEarlyExit(
+  const std::vector<index>& input, int32_t k, real threshold, real margin,
+  int64_t chunk, std::vector<std::pair<real, int32_t>>& heap,
+  Vector& hidden, Vector& output) const {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  if (chunk <= 0) {
+    throw std::invalid_argument("The early exit chunk needs to be positive!");
+  }
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  const int64_t ninput = input.size();
+  // every check keeps the best two labels, or k if more, which are reported
+  // after the last check instead of scoring the output layer again
+  const int32_t kcheck = std::max(k, 2);
+  Vector sum(hsz_);
+  sum.zero();
+  int64_t consumed = 0;
+  do {
+    const int64_t end = std::min(ninput, consumed + chunk);
+    for (; consumed < end; consumed++) {
+      if (quant_) {
+        sum.addRow(*qwi_, input[consumed]);
+      } else {
+        sum.addRow(*wi_, input[consumed]);
+      }
+    }
+    std::copy(sum.data(), sum.data() + hsz_, hidden.data());
+    hidden.mul(1.0 / std::max<int64_t>(consumed, 1));
+    heap.clear();
+    heap.reserve(kcheck + 1);
+    if (args_->loss == loss_name::hs) {
+      treeSearch(kcheck, 0.0, heap, hidden);
+    } else {
+      computeOutputSoftmax(hidden, output);
+      findKBest(kcheck, 0.0, heap, output);
+    }
+    std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  } while (consumed < ninput && heap.size() > 1 &&
+           heap[0].first - heap[1].first < margin);
+  const real minScore = std_log(threshold);
+  if (heap.size() > k) {
+    heap.resize(k);
+  }
+  while (!heap.empty() && heap.back().first < minScore) {
+    heap.pop_back();
+  }
+  return consumed;
+}
+
 void Model::predict(
   const std::vector<index>& input,
   int32_t k,
@@ -210,87 +297,393 @@ void Model::predict_paired(
   predict_paired(input, input2, k, threshold, heap, hidden_, hidden2, output_, output2);
 }
 
-void Model::findKBest(
+// Predicts the k most likely of labels only, with a softmax normalized
+// over them: output receives the scores of the labels, in their order.
+// Not available with hierarchical softmax, whose labels have no row.
+void Model::predictShortlist(
+  const Vector& hidden,
+  const std::vector<int32_t>& labels,
   int32_t k,
   real threshold,
   std::vector<std::pair<real, int32_t>>& heap,
-  Vector& output
-) const {
-  for (int32_t i = 0; i < osz_; i++) {
-    if (output[i] < threshold) continue;
-    if (heap.size() == k && std_log(output[i]) < heap.front().first) {
+  Vector& output) const {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  if (args_->model != model_name::sup || args_->loss == loss_name::hs) {
+    throw std::invalid_argument(
+        "Model needs to be supervised without hierarchical softmax for shortlists!");
+  }
+  assert(labels.size() <= output.size());
+  heap.clear();
+  heap.reserve(k + 1);
+  const int64_t n = labels.size();
+  real max = -std::numeric_limits<real>::infinity(), z = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    output[i] = quant_ && args_->qout ?
+      qwo_->dotRow(hidden, labels[i]) : wo_->dotRow(hidden, labels[i]);
+    max = std::max(output[i], max);
+  }
+  for (int64_t i = 0; i < n; i++) {
+    output[i] = std::exp(output[i] - max);
+    z += output[i];
+  }
+  for (int64_t i = 0; i < n; i++) {
+    const real p = output[i] / z;
+    if (p < threshold) continue;
+    if (heap.size() == k && std_log(p) < heap.front().first) {
       continue;
     }
-    heap.push_back(std::make_pair(std_log(output[i]), i));
+    heap.push_back(std::make_pair(std_log(p), labels[i]));
     std::push_heap(heap.begin(), heap.end(), comparePairs);
     if (heap.size() > k) {
       std::pop_heap(heap.begin(), heap.end(), comparePairs);
       heap.pop_back();
     }
   }
+  std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
-void Model::dfs(int32_t k, real threshold, int32_t node, real score,
-                std::vector<std::pair<real, int32_t>>& heap,
-                Vector& hidden) const {
-  if (score < std_log(threshold)) return;
-  if (heap.size() == k && score < heap.front().first) {
+// Predicts the first nb rows of hiddens, each row being a hidden vector,
+// into heaps[0] to heaps[nb - 1]. Rows are scored as a block, so that each
+// output row is loaded once per block instead of once per row. If
+// consensus is given, the posteriors of all rows are added to it; with
+// hierarchical softmax only the k best labels of each row contribute.
+void Model::predictBlock(
+  const Matrix& hiddens,
+  int64_t nb,
+  int32_t k,
+  real threshold,
+  std::vector<std::pair<real, int32_t>>* heaps,
+  Vector* consensus) const {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  assert(nb <= hiddens.size(0));
+  const bool hs = args_->loss == loss_name::hs;
+  const bool batched = !(quant_ && args_->qout) && !hs;
+  Vector hidden(hsz_);
+  Vector output(osz_);
+  std::vector<real> scores;
+  // with hierarchical softmax, the first two levels of the tree are visited
+  // by almost every row and are scored as a block; deeper nodes are mostly
+  // pruned by the search of a trained model
+  const int64_t ntop = hs ? std::min<int64_t>(flatTree_.size(), 3) : 0;
+  if (hs) {
+    scores.resize(nb * ntop);
+    for (int64_t n = 0; n < ntop; n++) {
+      const int32_t row = flatTree_[n].row;
+      for (int64_t b = 0; b < nb; b++) {
+        std::copy(hiddens.data() + b * hsz_, hiddens.data() + (b + 1) * hsz_,
+                  hidden.data());
+        scores[b * ntop + n] = quant_ && args_->qout ?
+          qwo_->dotRow(hidden, row) : wo_->dotRow(hidden, row);
+      }
+    }
+  } else if (batched) {
+    scores.resize(nb * osz_);
+    for (int64_t i = 0; i < osz_; i++) {
+      const real* wrow = wo_->data() + i * hsz_;
+      for (int64_t b = 0; b < nb; b++) {
+        const real* hrow = hiddens.data() + b * hsz_;
+        real d = 0.0;
+        for (int64_t j = 0; j < hsz_; j++) {
+          d += wrow[j] * hrow[j];
+        }
+        scores[b * osz_ + i] = d;
+      }
+    }
+  }
+  for (int64_t b = 0; b < nb; b++) {
+    auto& heap = heaps[b];
+    heap.clear();
+    heap.reserve(k + 1);
+    std::copy(hiddens.data() + b * hsz_, hiddens.data() + (b + 1) * hsz_,
+              hidden.data());
+    if (hs) {
+      treeSearch(k, threshold, heap, hidden, scores.data() + b * ntop, ntop);
+      if (consensus) {
+        for (auto it = heap.cbegin(); it != heap.cend(); ++it) {
+          (*consensus)[it->second] += std::exp(it->first);
+        }
+      }
+    } else {
+      if (batched) {
+        std::copy(scores.begin() + b * osz_, scores.begin() + (b + 1) * osz_,
+                  output.data());
+        normalizeSoftmax(output);
+      } else {
+        computeOutputSoftmax(hidden, output);
+      }
+      if (consensus) {
+        consensus->addVector(output);
+      }
+      findKBest(k, threshold, heap, output);
+    }
+    std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  }
+}
+
+// Predicts each window [begin, end) of ngrams from a single prefix sum,
+// so that each hidden vector costs O(dim) whatever the window size.
+// consensus receives the posteriors averaged over all windows.
+void Model::predictWindows(
+  const std::vector<index>& input,
+  const std::vector<std::pair<int32_t, int32_t>>& windows,
+  int32_t k,
+  real threshold,
+  std::vector<std::vector<std::pair<real, int32_t>>>& heaps,
+  Vector& consensus) const {
+  const int64_t nwindows = windows.size();
+  heaps.assign(nwindows, std::vector<std::pair<real, int32_t>>());
+  consensus.zero();
+  if (nwindows == 0) {
     return;
   }
+  // running sum of the embeddings of the ngrams first...last - 1, in double
+  // precision so that it does not drift along long sequences: as windows
+  // move forward, every ngram is added once and removed once
+  std::vector<double> sum(hsz_, 0.0);
+  int32_t first = 0, last = 0;
+  Vector row(hsz_);
+  auto add = [&](index id, double sign) {
+    row.zero();
+    if (quant_) {
+      row.addRow(*qwi_, id);
+    } else {
+      row.addRow(*wi_, id);
+    }
+    for (int64_t j = 0; j < hsz_; j++) {
+      sum[j] += sign * row[j];
+    }
+  };
+
+  const int64_t B = 32;
+  Matrix hiddens(B, hsz_);
+  for (int64_t w0 = 0; w0 < nwindows; w0 += B) {
+    const int64_t nb = std::min(B, nwindows - w0);
+    for (int64_t b = 0; b < nb; b++) {
+      const int32_t begin = windows[w0 + b].first;
+      const int32_t end = windows[w0 + b].second;
+      assert(begin < end);
+      // restart from an empty sum for a window that does not overlap the
+      // previous one or does not move forward
+      if (begin < first || begin >= last || end < last) {
+        std::fill(sum.begin(), sum.end(), 0.0);
+        first = last = begin;
+      }
+      for (; last < end; last++) {
+        add(input[last], 1.0);
+      }
+      for (; first < begin; first++) {
+        add(input[first], -1.0);
+      }
+      const double scale = 1.0 / (end - begin);
+      for (int64_t j = 0; j < hsz_; j++) {
+        hiddens.at(b, j) = sum[j] * scale;
+      }
+    }
+    predictBlock(hiddens, nb, k, threshold, &heaps[w0], &consensus);
+  }
+  consensus.mul(1.0 / nwindows);
+}
 
-  if (tree[node].left == -1 && tree[node].right == -1) {
-    heap.push_back(std::make_pair(score, node));
+void Model::findKBest(
+  int32_t k,
+  real threshold,
+  std::vector<std::pair<real, int32_t>>& heap,
+  Vector& output
+) const {
+  for (int32_t i = 0; i < osz_; i++) {
+    if (output[i] < threshold) continue;
+    if (heap.size() == k && std_log(output[i]) < heap.front().first) {
+      continue;
+    }
+    heap.push_back(std::make_pair(std_log(output[i]), i));
     std::push_heap(heap.begin(), heap.end(), comparePairs);
     if (heap.size() > k) {
       std::pop_heap(heap.begin(), heap.end(), comparePairs);
       heap.pop_back();
     }
-    return;
   }
+}
 
-  real f;
-  if (quant_ && args_->qout) {
-    f= qwo_->dotRow(hidden, node - osz_);
-  } else {
-    f= wo_->dotRow(hidden, node - osz_);
+/*
+Tree search
+Best-first search of the k most likely labels: the nodes to visit are kept
+in a queue by decreasing log-probability of their path from the root, and
+since log-probabilities only decrease down the tree, the leaves come out
+of the queue by decreasing probability. The search stops after k leaves,
+or at the first node below the threshold. dots optionally holds the scores
+of the first ndots nodes of the flattened tree, computed beforehand.
+*/
+void Model::treeSearch(int32_t k, real threshold,
+                       std::vector<std::pair<real, int32_t>>& heap,
+                       const Vector& hidden,
+                       const real* dots,
+                       int64_t ndots) const {
+  const real minScore = std_log(threshold);
+  // queue entries are internal nodes, or leaves as -1 - label
+  std::vector<std::pair<real, int32_t>> queue;
+  queue.reserve(64);
+  // a tree of a single label is a leaf
+  queue.push_back(std::make_pair(0.0, flatTree_.empty() ? -1 : 0));
+  while (!queue.empty() && heap.size() < k) {
+    std::pop_heap(queue.begin(), queue.end());
+    const real score = queue.back().first;
+    const int32_t node = queue.back().second;
+    queue.pop_back();
+    if (score < minScore) {
+      break;
+    }
+    if (node < 0) {
+      heap.push_back(std::make_pair(score, -1 - node));
+      std::push_heap(heap.begin(), heap.end(), comparePairs);
+      continue;
+    }
+    const FlatNode& flat = flatTree_[node];
+    real f;
+    if (node < ndots) {
+      f = dots[node];
+    } else if (quant_ && args_->qout) {
+      f = qwo_->dotRow(hidden, flat.row);
+    } else {
+      f = wo_->dotRow(hidden, flat.row);
+    }
+    f = 1. / (1 + std::exp(-f));
+    queue.push_back(std::make_pair(score + std_log(1.0 - f), flat.children[0]));
+    std::push_heap(queue.begin(), queue.end());
+    queue.push_back(std::make_pair(score + std_log(f), flat.children[1]));
+    std::push_heap(queue.begin(), queue.end());
   }
-  f = 1. / (1 + std::exp(-f));
+}
 
-  dfs(k, threshold, tree[node].left, score + std_log(1.0 - f), heap, hidden);
-  dfs(k, threshold, tree[node].right, score + std_log(f), heap, hidden);
+// The current time, or the epoch if the times are not wanted, so that
+// untimed durations are zero without reading the clock
+static std::chrono::steady_clock::time_point clockNow(bool timed) {
+  return timed ? std::chrono::steady_clock::now()
+               : std::chrono::steady_clock::time_point();
 }
 
 void Model::update(const std::vector<index>& input, int32_t target, real lr) {
   assert(target >= 0);
   assert(target < osz_);
   if (input.size() == 0) return;
+  // forward covers the hidden vector and the output layer, including its
+  // update; backward covers the update of the input embeddings. The clock
+  // is only read if the times are wanted.
+  auto start = clockNow(timed_);
   computeHidden(input, hidden_);
-  if (args_->loss == loss_name::ns) {
-    loss_ += negativeSampling(target, lr);
-  } else if (args_->loss == loss_name::hs) {
-    loss_ += hierarchicalSoftmax(target, lr);
-  } else {
-    loss_ += softmax(target, lr);
-  }
+  loss_ += updateOutput(target, lr);
   nexamples_ += 1;
-  
+  auto middle = clockNow(timed_);
+
   if (!args_->freezeEmbeddings) {
     if (args_->model == model_name::sup) {
       grad_.mul(1.0 / input.size());
     }
-    for (auto it = input.cbegin(); it != input.cend(); ++it) {
-      wi_->addRow(grad_, *it, 1.0);
+    if (inputGradients_) {
+      inputGradients_->add(input, grad_);
+    } else {
+      for (auto it = input.cbegin(); it != input.cend(); ++it) {
+        wi_->addRow(grad_, *it, 1.0);
+      }
+      if (touchedRows_) {
+        for (auto it = input.cbegin(); it != input.cend(); ++it) {
+          (*touchedRows_)[*it] = 1;
+        }
+      }
+    }
+  }
+  auto end = clockNow(timed_);
+  forwardTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      middle - start).count();
+  backwardTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      end - middle).count();
+}
+
+// Updates the output layer only, for a hidden vector computed elsewhere
+// from frozen embeddings
+void Model::update(const Vector& hidden, int32_t target, real lr) {
+  assert(target >= 0);
+  assert(target < osz_);
+  auto start = clockNow(timed_);
+  std::copy(hidden.data(), hidden.data() + hsz_, hidden_.data());
+  loss_ += updateOutput(target, lr);
+  nexamples_ += 1;
+  forwardTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clockNow(timed_) - start).count();
+}
+
+real Model::updateOutput(int32_t target, real lr) {
+  if (args_->loss == loss_name::ns) {
+    return negativeSampling(target, lr);
+  } else if (args_->loss == loss_name::hs) {
+    return hierarchicalSoftmax(target, lr);
+  } else {
+    return softmax(target, lr);
+  }
+}
+
+void Model::setInputGradients(InputGradients* gradients) {
+  inputGradients_ = gradients;
+}
+
+// Marks the input rows updated by Model::update in rows
+void Model::setTouchedRows(std::vector<uint8_t>* rows) {
+  touchedRows_ = rows;
+}
+
+void Model::setTimed(bool timed) {
+  timed_ = timed;
+}
+
+void InputGradients::clear() {
+  rows.clear();
+  ends.clear();
+  grads.clear();
+}
+
+void InputGradients::add(const std::vector<index>& input, const Vector& grad) {
+  rows.insert(rows.end(), input.cbegin(), input.cend());
+  ends.push_back(rows.size());
+  grads.insert(grads.end(), grad.data(), grad.data() + grad.size());
+}
+
+// Applies the updates, in order, to the rows r of wi with r % nparts == part
+void InputGradients::apply(Matrix& wi, int32_t part, int32_t nparts) const {
+  const int64_t dim = wi.size(1);
+  size_t begin = 0;
+  for (size_t u = 0; u < ends.size(); u++) {
+    const real* grad = grads.data() + u * dim;
+    for (size_t i = begin; i < ends[u]; i++) {
+      if (rows[i] % nparts != part) {
+        continue;
+      }
+      real* row = wi.data() + rows[i] * dim;
+      for (int64_t j = 0; j < dim; j++) {
+        row[j] += grad[j];
+      }
     }
+    begin = ends[u];
   }
 }
 
-void Model::setTargetCounts(const std::vector<int64_t>& counts) {
+void Model::setTargetCounts(const std::vector<int64_t>& counts,
+                            const std::vector<int32_t>& children) {
   assert(counts.size() == osz_);
   if (args_->loss == loss_name::ns) {
     initTableNegatives(counts);
   }
   if (args_->loss == loss_name::hs) {
-    buildTree(counts);
+    if (children.empty()) {
+      buildTree(counts);
+    } else {
+      setTree(counts, children);
+    }
   }
 }
 
@@ -317,47 +710,161 @@ index Model::getNegative(index target) {
   return negative;
 }
 
-void Model::buildTree(const std::vector<int64_t>& counts) {
-  tree.resize(2 * osz_ - 1);
-  for (int32_t i = 0; i < 2 * osz_ - 1; i++) {
+// Initializes the 2 * n - 1 nodes of a tree of n leaves
+static void initTree(std::vector<Node>& tree,
+                     const std::vector<int64_t>& counts) {
+  const int32_t n = counts.size();
+  tree.resize(2 * n - 1);
+  for (int32_t i = 0; i < 2 * n - 1; i++) {
     tree[i].parent = -1;
     tree[i].left = -1;
     tree[i].right = -1;
     tree[i].count = 1e15;
     tree[i].binary = false;
   }
-  for (int32_t i = 0; i < osz_; i++) {
+  for (int32_t i = 0; i < n; i++) {
     tree[i].count = counts[i];
   }
-  int32_t leaf = osz_ - 1;
-  int32_t node = osz_;
-  for (int32_t i = osz_; i < 2 * osz_ - 1; i++) {
+}
+
+static void linkNode(std::vector<Node>& tree, int32_t i,
+                     int32_t left, int32_t right) {
+  tree[i].left = left;
+  tree[i].right = right;
+  tree[i].count = tree[left].count + tree[right].count;
+  tree[left].parent = i;
+  tree[right].parent = i;
+  tree[right].binary = true;
+}
+
+// Merges the leaves first...last - 1 into a Huffman tree whose internal
+// nodes are numbered from node on, and returns its root
+static int32_t mergeLeaves(std::vector<Node>& tree, int32_t first,
+                           int32_t last, int32_t node) {
+  int32_t leaf = last - 1;
+  int32_t next = node;
+  for (int32_t i = node; i < node + last - first - 1; i++) {
     int32_t mini[2];
     for (int32_t j = 0; j < 2; j++) {
-      if (leaf >= 0 && tree[leaf].count < tree[node].count) {
+      if (leaf >= first && tree[leaf].count < tree[next].count) {
         mini[j] = leaf--;
       } else {
-        mini[j] = node++;
+        mini[j] = next++;
+      }
+    }
+    linkNode(tree, i, mini[0], mini[1]);
+  }
+  return last - first > 1 ? node + last - first - 2 : first;
+}
+
+void Model::buildTree(const std::vector<int64_t>& counts) {
+  initTree(tree, counts);
+  mergeLeaves(tree, 0, osz_, osz_);
+  buildPaths();
+}
+
+// Sets a tree given by the children of its internal nodes, as getTree
+void Model::setTree(const std::vector<int64_t>& counts,
+                    const std::vector<int32_t>& children) {
+  if (children.size() != 2 * size_t(osz_ - 1)) {
+    throw std::invalid_argument("The tree does not match the labels!");
+  }
+  initTree(tree, counts);
+  for (int32_t i = osz_; i < 2 * osz_ - 1; i++) {
+    const int32_t left = children[2 * (i - osz_)];
+    const int32_t right = children[2 * (i - osz_) + 1];
+    if (left < 0 || right < 0 || left >= i || right >= i || left == right ||
+        tree[left].parent != -1 || tree[right].parent != -1) {
+      throw std::invalid_argument("The tree is invalid!");
+    }
+    linkNode(tree, i, left, right);
+  }
+  buildPaths();
+}
+
+// Children of the internal nodes, left then right, in the order of their
+// rows in the output matrix
+std::vector<int32_t> Model::getTree() const {
+  std::vector<int32_t> children;
+  for (int32_t i = osz_; i < 2 * osz_ - 1; i++) {
+    children.push_back(tree[i].left);
+    children.push_back(tree[i].right);
+  }
+  return children;
+}
+
+/*
+Extends the tree to the labels of counts, the first of which are the labels
+of this model, in the format of getTree: the internal nodes of this tree
+keep their rows, the new labels are merged into a Huffman tree of their
+own, and both trees are joined under a new root.
+*/
+std::vector<int32_t> Model::extendTree(
+    const std::vector<int64_t>& counts) const {
+  const int32_t n = counts.size();
+  std::vector<Node> extended;
+  initTree(extended, counts);
+  // internal node i of this tree is node i + n - osz_ of the extended tree
+  for (int32_t i = osz_; i < 2 * osz_ - 1; i++) {
+    int32_t children[2] = {tree[i].left, tree[i].right};
+    for (int32_t c = 0; c < 2; c++) {
+      if (children[c] >= osz_) {
+        children[c] += n - osz_;
       }
     }
-    tree[i].left = mini[0];
-    tree[i].right = mini[1];
-    tree[i].count = tree[mini[0]].count + tree[mini[1]].count;
-    tree[mini[0]].parent = i;
-    tree[mini[1]].parent = i;
-    tree[mini[1]].binary = true;
+    linkNode(extended, i + n - osz_, children[0], children[1]);
   }
+  if (n > osz_) {
+    const int32_t root = mergeLeaves(extended, osz_, n, n + osz_ - 1);
+    linkNode(extended, 2 * n - 2, osz_ > 1 ? n + osz_ - 2 : 0, root);
+  }
+  std::vector<int32_t> children;
+  for (int32_t i = n; i < 2 * n - 1; i++) {
+    children.push_back(extended[i].left);
+    children.push_back(extended[i].right);
+  }
+  return children;
+}
+
+// Paths of the labels from their leaf to the root
+void Model::buildPaths() {
+  pathRows_.clear();
+  pathCodes_.clear();
+  pathOffsets_.assign(1, 0);
   for (int32_t i = 0; i < osz_; i++) {
-    std::vector<int32_t> path;
-    std::vector<bool> code;
     int32_t j = i;
     while (tree[j].parent != -1) {
-      path.push_back(tree[j].parent - osz_);
-      code.push_back(tree[j].binary);
+      pathRows_.push_back(tree[j].parent - osz_);
+      pathCodes_.push_back(tree[j].binary);
       j = tree[j].parent;
     }
-    paths.push_back(path);
-    codes.push_back(code);
+    pathOffsets_.push_back(pathRows_.size());
+  }
+  flattenTree();
+}
+
+// Numbers the internal nodes in breadth-first order from the root, so that
+// the top levels, visited by every search, are contiguous
+void Model::flattenTree() {
+  flatTree_.clear();
+  if (osz_ < 2) {
+    return;
+  }
+  std::vector<int32_t> order(1, 2 * osz_ - 2);
+  for (size_t n = 0; n < order.size(); n++) {
+    const Node& node = tree[order[n]];
+    FlatNode flat;
+    flat.row = order[n] - osz_;
+    const int32_t children[2] = {node.left, node.right};
+    for (int32_t c = 0; c < 2; c++) {
+      if (children[c] < osz_) {
+        flat.children[c] = -1 - children[c];
+      } else {
+        flat.children[c] = order.size();
+        order.push_back(children[c]);
+      }
+    }
+    flatTree_.push_back(flat);
   }
 }
 
@@ -365,6 +872,14 @@ real Model::getLoss() const {
   return loss_ / nexamples_;
 }
 
+int64_t Model::getForwardTime() const {
+  return forwardTime_;
+}
+
+int64_t Model::getBackwardTime() const {
+  return backwardTime_;
+}
+
 void Model::initSigmoid() {
   for (int i = 0; i < SIGMOID_TABLE_SIZE + 1; i++) {
     real x = real(i * 2 * MAX_SIGMOID) / SIGMOID_TABLE_SIZE - MAX_SIGMOID;
@@ -30,6 +30,27 @@ struct Node {
   bool binary;
 };
 
+// Internal node of the flattened hierarchical softmax tree: row is its row
+// in the output matrix, children[c] the index of its child of code c in
+// the flattened tree, or -1 - label if the child is a leaf.
+struct FlatNode {
+  int32_t row;
+  int32_t children[2];
+};
+
+// Gradients of the input embeddings recorded by Model::update instead of
+// being applied, for deterministic training: update u adds the dim values
+// grads[u * dim...] to each of the rows rows[ends[u - 1]...ends[u]).
+struct InputGradients {
+  std::vector<index> rows;
+  std::vector<size_t> ends;
+  std::vector<real> grads;
+
+  void clear();
+  void add(const std::vector<index>&, const Vector&);
+  void apply(Matrix&, int32_t, int32_t) const;
+};
+
 class Model {
   protected:
     std::shared_ptr<Matrix> wi_;
@@ -44,15 +65,27 @@ class Model {
     int32_t osz_;
     real loss_;
     int64_t nexamples_;
+    // time spent in update, in nanoseconds, if timed_ is set
+    bool timed_;
+    int64_t forwardTime_;
+    int64_t backwardTime_;
     std::vector<real> t_sigmoid_;
     std::vector<real> t_log_;
     // used for negative sampling:
     std::vector<int32_t> negatives_;
     size_t negpos;
-    // used for hierarchical softmax:
-    std::vector< std::vector<int32_t> > paths;
-    std::vector< std::vector<bool> > codes;
+    // used for hierarchical softmax: the path of label i from its leaf to
+    // the root goes through the output rows pathRows_[pathOffsets_[i]...
+    // pathOffsets_[i + 1]), with codes pathCodes_[...]
+    std::vector<int32_t> pathRows_;
+    std::vector<uint8_t> pathCodes_;
+    std::vector<int32_t> pathOffsets_;
     std::vector<Node> tree;
+    std::vector<FlatNode> flatTree_;
+    InputGradients* inputGradients_;
+    std::vector<uint8_t>* touchedRows_;
+
+    real updateOutput(int32_t, real);
 
     static bool comparePairs(const std::pair<real, int32_t>&,
                              const std::pair<real, int32_t>&);
@@ -84,20 +117,47 @@ class Model {
     void predict_paired(const std::vector<index>&, const std::vector<index>&,
                         int32_t, real,
                         std::vector<std::pair<real, int32_t>>&);
-    void dfs(int32_t, real, int32_t, real,
-             std::vector<std::pair<real, int32_t>>&,
-             Vector&) const;
+    void treeSearch(int32_t, real, std::vector<std::pair<real, int32_t>>&,
+                    const Vector&, const real* = nullptr, int64_t = 0) const;
+    int64_t predictEarlyExit(const std::vector<index>&, int32_t, real, real,
+                             int64_t, std::vector<std::pair<real, int32_t>>&,
+                             Vector&, Vector&) const;
+    void predictShortlist(const Vector&, const std::vector<int32_t>&,
+                          int32_t, real,
+                          std::vector<std::pair<real, int32_t>>&,
+                          Vector&) const;
+    void predictBlock(const Matrix&, int64_t, int32_t, real,
+                      std::vector<std::pair<real, int32_t>>*,
+                      Vector*) const;
+    void predictWindows(const std::vector<index>&,
+                        const std::vector<std::pair<int32_t, int32_t>>&,
+                        int32_t, real,
+                        std::vector<std::vector<std::pair<real, int32_t>>>&,
+                        Vector&) const;
     void findKBest(int32_t, real, std::vector<std::pair<real, int32_t>>&,
                    Vector&) const;
     void update(const std::vector<index>&, int32_t, real);
+    void update(const Vector&, int32_t, real);
     void computeHidden(const std::vector<index>&, Vector&) const;
     void computeOutputSoftmax(Vector&, Vector&) const;
     void computeOutputSoftmax();
+    void normalizeSoftmax(Vector&) const;
 
-    void setTargetCounts(const std::vector<int64_t>&);
+    void setTargetCounts(const std::vector<int64_t>&,
+                         const std::vector<int32_t>& = std::vector<int32_t>());
+    void setInputGradients(InputGradients*);
+    void setTouchedRows(std::vector<uint8_t>*);
+    void setTimed(bool);
     void initTableNegatives(const std::vector<int64_t>&);
     void buildTree(const std::vector<int64_t>&);
+    void setTree(const std::vector<int64_t>&, const std::vector<int32_t>&);
+    std::vector<int32_t> getTree() const;
+    std::vector<int32_t> extendTree(const std::vector<int64_t>&) const;
+    void buildPaths();
+    void flattenTree();
     real getLoss() const;
+    int64_t getForwardTime() const;
+    int64_t getBackwardTime() const;
     real sigmoid(real) const;
     real log(real) const;
     real std_log(real) const;
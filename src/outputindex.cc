@@ -0,0 +1,148 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "outputindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace fasttext {
+
+// number of centroids of a sub-quantizer of 8 bits
+static const int32_t NLISTS = 256;
+
+OutputIndex::OutputIndex(const Matrix& wo, int32_t nprobe)
+  : dim_(wo.size(1)), nlabels_(wo.size(0)), nlists_(NLISTS),
+    nprobe_(nprobe), pq_(wo.size(1), wo.size(1)), reads_(0), candidates_(0) {
+  if (nlabels_ < nlists_) {
+    throw std::invalid_argument(
+        "The output index needs at least " + std::to_string(nlists_) + " labels!");
+  }
+  if (nprobe <= 0 || nprobe > nlists_) {
+    throw std::invalid_argument(
+        "The output index probes between 1 and " + std::to_string(nlists_) + " lists!");
+  }
+  pq_.train(nlabels_, wo.data());
+  std::vector<uint8_t> codes(nlabels_);
+  pq_.compute_codes(wo.data(), codes.data(), nlabels_);
+  offsets_.assign(nlists_ + 1, 0);
+  for (int32_t i = 0; i < nlabels_; i++) {
+    offsets_[codes[i] + 1]++;
+  }
+  for (int32_t l = 0; l < nlists_; l++) {
+    offsets_[l + 1] += offsets_[l];
+  }
+  std::vector<int64_t> next(offsets_.begin(), offsets_.end() - 1);
+  rows_.resize(int64_t(nlabels_) * dim_);
+  labels_.resize(nlabels_);
+  for (int32_t i = 0; i < nlabels_; i++) {
+    const int64_t j = next[codes[i]]++;
+    std::copy(wo.data() + int64_t(i) * dim_, wo.data() + int64_t(i + 1) * dim_,
+              rows_.data() + j * dim_);
+    labels_[j] = i;
+  }
+}
+
+// Predicts the k most likely labels among the rows of the probed lists
+void OutputIndex::predict(const Vector& hidden,
+                          int32_t k,
+                          real threshold,
+                          std::vector<std::pair<real, int32_t>>& heap,
+                          State& state) {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  state.centroids.resize(nlists_);
+  for (int32_t l = 0; l < nlists_; l++) {
+    const real* c = pq_.get_centroids(0, l);
+    real d = 0.0;
+    for (int32_t j = 0; j < dim_; j++) {
+      d += c[j] * hidden[j];
+    }
+    state.centroids[l] = d;
+  }
+  state.lists.resize(nlists_);
+  for (int32_t l = 0; l < nlists_; l++) {
+    state.lists[l] = l;
+  }
+  std::partial_sort(state.lists.begin(), state.lists.begin() + nprobe_,
+                    state.lists.end(), [&](int32_t a, int32_t b) {
+                      return state.centroids[a] > state.centroids[b];
+                    });
+  state.scores.clear();
+  real max = -std::numeric_limits<real>::infinity();
+  for (int32_t p = 0; p < nprobe_; p++) {
+    const int32_t l = state.lists[p];
+    for (int64_t j = offsets_[l]; j < offsets_[l + 1]; j++) {
+      const real* row = rows_.data() + j * dim_;
+      real d = 0.0;
+      for (int32_t i = 0; i < dim_; i++) {
+        d += row[i] * hidden[i];
+      }
+      state.scores.push_back(d);
+      max = std::max(max, d);
+    }
+  }
+  for (int32_t p = nprobe_; p < nlists_; p++) {
+    max = std::max(max, state.centroids[state.lists[p]]);
+  }
+  real z = 0.0;
+  for (auto it = state.scores.begin(); it != state.scores.end(); ++it) {
+    *it = std::exp(*it - max);
+    z += *it;
+  }
+  for (int32_t p = nprobe_; p < nlists_; p++) {
+    const int32_t l = state.lists[p];
+    z += (offsets_[l + 1] - offsets_[l]) * std::exp(state.centroids[l] - max);
+  }
+  heap.clear();
+  heap.reserve(k + 1);
+  auto compare = [](const std::pair<real, int32_t>& l,
+                    const std::pair<real, int32_t>& r) {
+    return l.first > r.first;
+  };
+  size_t s = 0;
+  for (int32_t p = 0; p < nprobe_; p++) {
+    const int32_t l = state.lists[p];
+    for (int64_t j = offsets_[l]; j < offsets_[l + 1]; j++, s++) {
+      const real prob = state.scores[s] / z;
+      if (prob < threshold) continue;
+      // as Model::std_log
+      const real score = std::log(prob + 1e-5);
+      if (heap.size() == k && score < heap.front().first) {
+        continue;
+      }
+      heap.push_back(std::make_pair(score, labels_[j]));
+      std::push_heap(heap.begin(), heap.end(), compare);
+      if (heap.size() > k) {
+        std::pop_heap(heap.begin(), heap.end(), compare);
+        heap.pop_back();
+      }
+    }
+  }
+  std::sort_heap(heap.begin(), heap.end(), compare);
+  reads_++;
+  candidates_ += state.scores.size();
+}
+
+int32_t OutputIndex::nlabels() const {
+  return nlabels_;
+}
+
+int64_t OutputIndex::reads() const {
+  return reads_;
+}
+
+int64_t OutputIndex::candidates() const {
+  return candidates_;
+}
+
+}
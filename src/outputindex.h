@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "matrix.h"
+#include "productquantizer.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+/*
+Output index
+An inverted file over the rows of the output matrix, to find the labels of
+largest score without scoring all of them. The rows are clustered by a
+product quantizer of a single sub-quantizer, that is k-means with 256
+centroids, and copied list by list so that the rows of a list are
+contiguous. A hidden vector is scored against the centroids, and only the
+rows of the nprobe lists of best centroid are scored exactly.
+
+The softmax of the candidates is normalized by an estimate of the partition
+function: the exact sum over the candidates, plus for every list not
+probed its size times the exponential of the score of its centroid.
+*/
+class OutputIndex {
+ protected:
+  int32_t dim_;
+  int32_t nlabels_;
+  int32_t nlists_;
+  int32_t nprobe_;
+  ProductQuantizer pq_;
+  // rows_ holds the rows of list l at offsets_[l]...offsets_[l + 1], whose
+  // labels are labels_[...]
+  std::vector<real> rows_;
+  std::vector<int32_t> labels_;
+  std::vector<int64_t> offsets_;
+  std::atomic<int64_t> reads_;
+  std::atomic<int64_t> candidates_;
+
+ public:
+  // Buffers of a classification thread
+  struct State {
+    std::vector<real> centroids;
+    std::vector<int32_t> lists;
+    std::vector<real> scores;
+  };
+
+  OutputIndex(const Matrix&, int32_t);
+
+  void predict(const Vector&, int32_t, real,
+               std::vector<std::pair<real, int32_t>>&, State&);
+  int32_t nlabels() const;
+  int64_t reads() const;
+  int64_t candidates() const;
+};
+
+}
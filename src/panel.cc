@@ -0,0 +1,179 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "panel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "productquantizer.h"
+
+namespace fasttext {
+
+// the other bucket is estimated from at most one sub-quantizer of 8 bits
+static const int32_t NCENTROIDS = 256;
+
+Panel::Panel(const std::string& filename,
+             const Dictionary& dict,
+             const Matrix& wo,
+             bool other)
+  : dim_(wo.size(1)), nlabels_(dict.nlabels()), other_(other),
+    reads_(0), others_(0) {
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened!");
+  }
+  std::unordered_map<std::string, int32_t> ids;
+  for (int32_t i = 0; i < nlabels_; i++) {
+    ids[dict.getLabel(i)] = i;
+  }
+  std::vector<uint8_t> selected(nlabels_, 0);
+  std::string label;
+  while (in >> label) {
+    auto it = ids.find(label);
+    if (it == ids.end()) {
+      throw std::invalid_argument(label + " is not a label of the model!");
+    }
+    if (!selected[it->second]) {
+      selected[it->second] = 1;
+      labels_.push_back(it->second);
+    }
+  }
+  if (labels_.empty()) {
+    throw std::invalid_argument("The panel has no labels!");
+  }
+  rows_.resize(labels_.size() * dim_);
+  for (size_t i = 0; i < labels_.size(); i++) {
+    std::copy(wo.data() + int64_t(labels_[i]) * dim_,
+              wo.data() + int64_t(labels_[i] + 1) * dim_,
+              rows_.data() + i * dim_);
+  }
+  if (!other_) {
+    return;
+  }
+  std::vector<real> rest;
+  for (int32_t i = 0; i < nlabels_; i++) {
+    if (!selected[i]) {
+      rest.insert(rest.end(), wo.data() + int64_t(i) * dim_,
+                  wo.data() + int64_t(i + 1) * dim_);
+    }
+  }
+  const int32_t nrest = rest.size() / dim_;
+  if (nrest <= NCENTROIDS) {
+    centroids_.swap(rest);
+    sizes_.assign(nrest, 1);
+    return;
+  }
+  ProductQuantizer pq(dim_, dim_);
+  pq.train(nrest, rest.data());
+  std::vector<uint8_t> codes(nrest);
+  pq.compute_codes(rest.data(), codes.data(), nrest);
+  sizes_.assign(NCENTROIDS, 0);
+  for (int32_t i = 0; i < nrest; i++) {
+    sizes_[codes[i]]++;
+  }
+  centroids_.resize(NCENTROIDS * dim_);
+  for (int32_t c = 0; c < NCENTROIDS; c++) {
+    std::copy(pq.get_centroids(0, c), pq.get_centroids(0, c) + dim_,
+              centroids_.data() + c * dim_);
+  }
+}
+
+// Predicts the k most likely labels of the panel; scores is a buffer
+void Panel::predict(const Vector& hidden,
+                    int32_t k,
+                    real threshold,
+                    std::vector<std::pair<real, int32_t>>& heap,
+                    std::vector<real>& scores) {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  const int64_t n = labels_.size(), ncentroids = sizes_.size();
+  scores.resize(n + ncentroids);
+  real max = -std::numeric_limits<real>::infinity();
+  for (int64_t i = 0; i < n + ncentroids; i++) {
+    const real* row = i < n ? rows_.data() + i * dim_
+                            : centroids_.data() + (i - n) * dim_;
+    real d = 0.0;
+    for (int32_t j = 0; j < dim_; j++) {
+      d += row[j] * hidden[j];
+    }
+    scores[i] = d;
+    max = std::max(max, d);
+  }
+  real z = 0.0, other = 0.0;
+  for (int64_t i = 0; i < n + ncentroids; i++) {
+    scores[i] = std::exp(scores[i] - max);
+    if (i < n) {
+      z += scores[i];
+    } else {
+      other += sizes_[i - n] * scores[i];
+    }
+  }
+  z += other;
+  heap.clear();
+  heap.reserve(k + 1);
+  auto compare = [](const std::pair<real, int32_t>& l,
+                    const std::pair<real, int32_t>& r) {
+    return l.first > r.first;
+  };
+  // the other bucket is -1
+  for (int64_t i = 0; i <= n; i++) {
+    if (i == n && ncentroids == 0) {
+      break;
+    }
+    const real prob = (i < n ? scores[i] : other) / z;
+    if (prob < threshold) continue;
+    // as Model::std_log
+    const real score = std::log(prob + 1e-5);
+    if (heap.size() == k && score < heap.front().first) {
+      continue;
+    }
+    heap.push_back(std::make_pair(score, i < n ? labels_[i] : -1));
+    std::push_heap(heap.begin(), heap.end(), compare);
+    if (heap.size() > k) {
+      std::pop_heap(heap.begin(), heap.end(), compare);
+      heap.pop_back();
+    }
+  }
+  std::sort_heap(heap.begin(), heap.end(), compare);
+  reads_++;
+  auto it = std::find_if(heap.begin(), heap.end(),
+                         [](const std::pair<real, int32_t>& p) {
+                           return p.second < 0;
+                         });
+  if (it != heap.end()) {
+    if (it == heap.begin()) {
+      others_++;
+    }
+    heap.erase(it);
+  }
+}
+
+int32_t Panel::nlabels() const {
+  return nlabels_;
+}
+
+int32_t Panel::size() const {
+  return labels_.size();
+}
+
+int64_t Panel::reads() const {
+  return reads_;
+}
+
+int64_t Panel::others() const {
+  return others_;
+}
+
+}
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dictionary.h"
+#include "matrix.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+/*
+Panel
+Restricts the predictions to a panel of labels, listed one per line in a
+file: their rows of the output matrix are copied into a compact matrix,
+and the softmax is computed over them only.
+
+With the other bucket, the labels outside the panel compete as a single
+"other" label: their summed probability is estimated from at most 256
+centroids of their rows (the rows themselves if they are fewer), as the
+size of every cluster times the exponential of the score of its centroid.
+The bucket takes its place among the top k but is not reported, so that a
+read most likely outside the panel has no prediction.
+*/
+class Panel {
+ protected:
+  int32_t dim_;
+  int32_t nlabels_;
+  std::vector<int32_t> labels_;
+  std::vector<real> rows_;
+  bool other_;
+  std::vector<real> centroids_;
+  std::vector<int64_t> sizes_;
+  std::atomic<int64_t> reads_;
+  std::atomic<int64_t> others_;
+
+ public:
+  Panel(const std::string&, const Dictionary&, const Matrix&, bool);
+
+  void predict(const Vector&, int32_t, real,
+               std::vector<std::pair<real, int32_t>>&, std::vector<real>&);
+  int32_t nlabels() const;
+  int32_t size() const;
+  int64_t reads() const;
+  int64_t others() const;
+};
+
+}
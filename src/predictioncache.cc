@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "predictioncache.h"
+
+#include <stdexcept>
+
+#include "utils.h"
+
+namespace fasttext {
+
+static const int32_t NSHARDS = 64;
+
+PredictionCache::PredictionCache(int64_t capacity) : hits_(0), misses_(0) {
+  if (capacity <= 0) {
+    throw std::invalid_argument("The prediction cache needs a positive capacity!");
+  }
+  shardCapacity_ = (capacity + NSHARDS - 1) / NSHARDS;
+  for (int32_t i = 0; i < NSHARDS; i++) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+// Hash of a sequence of k-mer indices, seed distinguishes the mates
+uint64_t PredictionCache::hash(const std::vector<index>& words, uint64_t seed) {
+  uint64_t h = utils::mix64(seed ^ words.size());
+  for (auto it = words.cbegin(); it != words.cend(); ++it) {
+    h = utils::mix64(h ^ *it);
+  }
+  return h;
+}
+
+PredictionCache::Shard& PredictionCache::shard(uint64_t key) {
+  return *shards_[(key >> 58) % NSHARDS];
+}
+
+// Copies the predictions cached for key, if any, and marks them as used
+bool PredictionCache::get(uint64_t key, Predictions& predictions) {
+  Shard& s = shard(key);
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+      s.entries.splice(s.entries.begin(), s.entries, it->second);
+      predictions = it->second->second;
+      hits_++;
+      return true;
+    }
+  }
+  misses_++;
+  return false;
+}
+
+// Caches the predictions of key, evicting the least recently used entry
+// of its shard if full
+void PredictionCache::put(uint64_t key, const Predictions& predictions) {
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (s.index.count(key) > 0) {
+    return;
+  }
+  if (s.entries.size() >= shardCapacity_) {
+    s.index.erase(s.entries.back().first);
+    s.entries.pop_back();
+  }
+  s.entries.emplace_front(key, predictions);
+  s.index[key] = s.entries.begin();
+}
+
+int64_t PredictionCache::hits() const {
+  return hits_;
+}
+
+int64_t PredictionCache::misses() const {
+  return misses_;
+}
+
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dictionary.h"
+#include "real.h"
+
+namespace fasttext {
+
+/*
+Prediction cache
+Identical reads, frequent in amplicon libraries, have the same k-mers and
+hence the same predictions. The cache maps a 64-bit hash of the k-mer
+indices of a read, which are canonical, to its predictions. It is split
+into shards, each a bounded LRU list behind its own mutex, chosen by the
+high bits of the hash, so that threads rarely wait for each other.
+
+The predictions depend on k and the threshold, which are fixed for the
+lifetime of a cache.
+*/
+class PredictionCache {
+ protected:
+  typedef std::vector<std::pair<real, int32_t>> Predictions;
+  typedef std::list<std::pair<uint64_t, Predictions>> Entries;
+
+  struct Shard {
+    std::mutex mutex;
+    Entries entries;
+    std::unordered_map<uint64_t, Entries::iterator> index;
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  size_t shardCapacity_;
+  std::atomic<int64_t> hits_;
+  std::atomic<int64_t> misses_;
+
+  Shard& shard(uint64_t);
+
+ public:
+  explicit PredictionCache(int64_t);
+
+  static uint64_t hash(const std::vector<index>&, uint64_t = 0);
+
+  bool get(uint64_t, Predictions&);
+  void put(uint64_t, const Predictions&);
+  int64_t hits() const;
+  int64_t misses() const;
+};
+
+}
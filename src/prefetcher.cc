@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "prefetcher.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+
+namespace fasttext {
+
+// fragments per ring, refilled by halves
+static const size_t RING_SIZE = 256;
+
+Prefetcher::Prefetcher(std::shared_ptr<Args> args,
+                       std::shared_ptr<Dictionary> dict,
+                       const std::vector<uint64_t>& seeds)
+  : args_(args), dict_(dict), stop_(false) {
+  fd_ = open(args_->input.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) < 0) {
+    throw std::invalid_argument(
+        args_->input + " cannot be opened for training: " + strerror(errno));
+  }
+  size_ = st.st_size;
+  // the kernel readahead is wasted on random positions
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_RANDOM);
+  for (size_t t = 0; t < seeds.size(); t++) {
+    rings_.emplace_back(new Ring());
+    Ring& ring = *rings_.back();
+    ring.slots.resize(RING_SIZE);
+    ring.head = 0;
+    ring.tail = 0;
+    ring.holding = false;
+    ring.rng.seed(seeds[t]);
+    ring.rejected = 0;
+  }
+  nthreads_ = std::min<int32_t>(args_->prefetch, rings_.size());
+  for (int32_t i = 0; i < nthreads_; i++) {
+    threads_.push_back(std::thread([=]() { ioThread(i); }));
+  }
+}
+
+Prefetcher::~Prefetcher() {
+  stop_ = true;
+  space_.notify_all();
+  for (auto it = rings_.begin(); it != rings_.end(); ++it) {
+    std::lock_guard<std::mutex> lock((*it)->mutex);
+    (*it)->ready.notify_all();
+  }
+  for (auto it = threads_.begin(); it != threads_.end(); ++it) {
+    it->join();
+  }
+  close(fd_);
+}
+
+void Prefetcher::ioThread(int32_t threadId) {
+  std::vector<char> buffer;
+  while (!stop_) {
+    bool filled = false;
+    for (size_t r = threadId; r < rings_.size(); r += nthreads_) {
+      Ring& ring = *rings_[r];
+      size_t free;
+      {
+        std::lock_guard<std::mutex> lock(ring.mutex);
+        free = RING_SIZE - (ring.tail - ring.head);
+      }
+      if (free < RING_SIZE / 2) {
+        continue;
+      }
+      // the consumer never reads slots past tail, they are filled unlocked
+      const size_t n = fill(ring, free, buffer);
+      {
+        std::lock_guard<std::mutex> lock(ring.mutex);
+        ring.tail += n;
+      }
+      ring.ready.notify_one();
+      filled = true;
+    }
+    if (!filled) {
+      std::unique_lock<std::mutex> lock(spaceMutex_);
+      space_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+  }
+}
+
+// Samples and decodes at most n fragments after the tail of ring
+size_t Prefetcher::fill(Ring& ring, size_t n, std::vector<char>& buffer) {
+  std::uniform_int_distribution<int64_t> uniform(0, size_ - 1);
+  // room for the newlines of the lines of a fragment
+  const size_t readSize = args_->length + args_->length / 32 + 64;
+  std::vector<std::pair<int64_t, int32_t>> batch;
+  while (batch.size() < n) {
+    const int64_t pos = uniform(ring.rng);
+    const int32_t label = dict_->labelFromPos(pos);
+    if (label == -1) {
+      ring.rejected++;
+      continue;
+    }
+    batch.push_back(std::make_pair(pos, label));
+  }
+  for (auto it = batch.cbegin(); it != batch.cend(); ++it) {
+    posix_fadvise(fd_, it->first, readSize, POSIX_FADV_WILLNEED);
+  }
+  size_t filled = 0;
+  for (auto it = batch.cbegin(); it != batch.cend() && !stop_; ++it) {
+    Fragment& fragment = ring.slots[(ring.tail + filled) % RING_SIZE];
+    bool read = false;
+    for (size_t size = readSize; ; size *= 2) {
+      buffer.resize(size);
+      size_t got = 0;
+      while (got < size) {
+        ssize_t r = pread(fd_, buffer.data() + got, size - got, it->first + got);
+        if (r < 0 && errno == EINTR) {
+          continue;
+        }
+        if (r <= 0) {
+          break;
+        }
+        got += r;
+      }
+      MemoryBuffer mb(buffer.data(), got);
+      std::istream in(&mb);
+      read = dict_->readSequence(in, fragment.ngrams, args_->length, true, ring.rng);
+      // read again with a larger buffer if the fragment was cut short
+      if (got < size || mb.consumed() < got) {
+        break;
+      }
+    }
+    if (read) {
+      fragment.label = it->second;
+      filled++;
+    } else {
+      ring.rejected++;
+    }
+  }
+  return filled;
+}
+
+// Releases the fragment returned by the previous call, and returns the
+// next one of ring t, waiting for it if needed
+const Fragment& Prefetcher::next(int32_t t) {
+  Ring& ring = *rings_[t];
+  std::unique_lock<std::mutex> lock(ring.mutex);
+  if (ring.holding) {
+    ring.head++;
+    ring.holding = false;
+    if (ring.tail - ring.head == RING_SIZE / 2) {
+      space_.notify_all();
+    }
+  }
+  ring.ready.wait(lock, [&]() { return ring.head < ring.tail || stop_; });
+  if (ring.head == ring.tail) {
+    throw std::runtime_error("Prefetcher stopped");
+  }
+  ring.holding = true;
+  return ring.slots[ring.head % RING_SIZE];
+}
+
+// Returns the number of positions rejected for ring t since the last call
+int64_t Prefetcher::takeRejected(int32_t t) {
+  return rings_[t]->rejected.exchange(0);
+}
+
+}
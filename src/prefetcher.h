@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "args.h"
+#include "dictionary.h"
+
+namespace fasttext {
+
+// Read-only stream buffer over bytes already in memory
+class MemoryBuffer : public std::streambuf {
+ public:
+  MemoryBuffer(char* data, size_t size) {
+    setg(data, data, data + size);
+  }
+  size_t consumed() const {
+    return gptr() - eback();
+  }
+};
+
+struct Fragment {
+  int32_t label;
+  std::vector<index> ngrams;
+};
+
+/*
+Fragment prefetcher
+I/O threads sample the training fragments ahead of the training threads:
+each training thread has a ring of decoded fragments, refilled by batches
+of half a ring by the I/O thread in charge of it. The positions of a batch
+are drawn first and announced to the kernel with posix_fadvise, so that
+the disk serves them concurrently, then read with pread and decoded with
+noise into the ring. A training thread only waits when its ring is empty.
+
+Ring t draws from its own generator, seeded as training thread t.
+*/
+class Prefetcher {
+ protected:
+  struct Ring {
+    std::vector<Fragment> slots;
+    // fragments [head, tail) are ready, slot head is held by the consumer
+    // if holding is set
+    size_t head;
+    size_t tail;
+    bool holding;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::mt19937_64 rng;
+    std::atomic<int64_t> rejected;
+  };
+
+  std::shared_ptr<Args> args_;
+  std::shared_ptr<Dictionary> dict_;
+  int fd_;
+  int64_t size_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  int32_t nthreads_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> stop_;
+  // I/O threads sleep on space until a ring is half empty
+  std::mutex spaceMutex_;
+  std::condition_variable space_;
+
+  void ioThread(int32_t);
+  size_t fill(Ring&, size_t, std::vector<char>&);
+
+ public:
+  Prefetcher(std::shared_ptr<Args>, std::shared_ptr<Dictionary>,
+             const std::vector<uint64_t>&);
+  ~Prefetcher();
+
+  const Fragment& next(int32_t);
+  int64_t takeRejected(int32_t);
+};
+
+}
@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "prefixcache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#include "utils.h"
+
+namespace fasttext {
+
+// IEEE half precision, rounded to nearest even
+static uint16_t toHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000;
+  const int32_t exponent = int32_t((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const uint32_t shift = 14 - exponent;
+    uint32_t h = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    if (rest > half || (rest == half && (h & 1))) {
+      h++;
+    }
+    return sign | h;
+  }
+  uint32_t h = (uint32_t(exponent) << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) {
+    h++;
+  }
+  return sign | h;
+}
+
+static inline float toFloat(uint16_t h) {
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  uint32_t x;
+  if (exponent == 0) {
+    const float f = mantissa * 5.9604644775390625e-8f;
+    return sign ? -f : f;
+  } else if (exponent == 31) {
+    x = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+PrefixCache::PrefixCache(int32_t stride)
+  : stride_(stride), anchorEvery_(std::max<int64_t>(1, ANCHOR_SPAN / stride)),
+    dim_(0) {
+  if (stride_ <= 0) {
+    throw std::invalid_argument("The prefix sum stride must be positive!");
+  }
+}
+
+void PrefixCache::buildSequence(std::ifstream& in,
+                                const Dictionary& dict,
+                                const Matrix& input,
+                                int32_t i,
+                                std::mt19937_64& rng,
+                                std::vector<index>& ngrams,
+                                std::vector<int32_t>& counts) {
+  utils::seek(in, dict.getEntry(i).seq_pos);
+  dict.readSequence(in, ngrams, -1, false, rng, &counts);
+  const int64_t bases = counts.size() - 1;
+  const int64_t nvalid = std::min(bases / stride_ + 1, offsets_[i + 1] - offsets_[i]);
+  std::vector<double> sum(dim_, 0.0);
+  real* anchor = nullptr;
+  int64_t n = 0;
+  for (int64_t j = 0; j < nvalid; j++) {
+    for (; n < counts[j * stride_]; n++) {
+      const real* row = input.data() + int64_t(ngrams[n]) * dim_;
+      for (int64_t k = 0; k < dim_; k++) {
+        sum[k] += row[k];
+      }
+    }
+    if (j % anchorEvery_ == 0) {
+      anchor = anchors_.data() + (anchorOffsets_[i] + j / anchorEvery_) * dim_;
+      std::copy(sum.cbegin(), sum.cend(), anchor);
+    }
+    uint16_t* delta = deltas_.data() + (offsets_[i] + j) * dim_;
+    for (int64_t k = 0; k < dim_; k++) {
+      delta[k] = toHalf(sum[k] - anchor[k]);
+    }
+    counts_[offsets_[i] + j] = counts[j * stride_];
+  }
+  valid_[i] = nvalid;
+}
+
+void PrefixCache::build(const std::string& fasta,
+                        const Dictionary& dict,
+                        const Matrix& input,
+                        int32_t thread) {
+  const int32_t nsequences = dict.nsequences();
+  dim_ = input.size(1);
+  offsets_.assign(nsequences + 1, 0);
+  anchorOffsets_.assign(nsequences + 1, 0);
+  valid_.assign(nsequences, 0);
+  labels_.resize(nsequences);
+  // sequence lengths in the dictionary include ambiguous bases, an upper bound
+  for (int32_t i = 0; i < nsequences; i++) {
+    const int64_t ncheckpoints = dict.getEntry(i).count / stride_ + 1;
+    offsets_[i + 1] = offsets_[i] + ncheckpoints;
+    anchorOffsets_[i + 1] = anchorOffsets_[i] +
+      (ncheckpoints + anchorEvery_ - 1) / anchorEvery_;
+    labels_[i] = dict.getLabelId(i);
+  }
+  counts_.assign(offsets_.back(), 0);
+  deltas_.assign(offsets_.back() * dim_, 0);
+  anchors_.assign(anchorOffsets_.back() * dim_, 0.0);
+
+  std::atomic<int32_t> next(0);
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < std::max(thread, 1); t++) {
+    threads.push_back(std::thread([&]() {
+      std::ifstream in(fasta);
+      if (!in.is_open()) {
+        return;
+      }
+      std::mt19937_64 rng(0);
+      std::vector<index> ngrams;
+      std::vector<int32_t> counts;
+      for (int32_t i = next++; i < nsequences; i = next++) {
+        buildSequence(in, dict, input, i, rng, ngrams, counts);
+      }
+    }));
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+  if (nsequences > 0 && valid_[0] == 0) {
+    throw std::invalid_argument(fasta + " cannot be opened for training!");
+  }
+}
+
+// Computes the hidden vector of a random fragment of about length bases,
+// returns false if the fragment has no k-mer
+bool PrefixCache::sample(std::mt19937_64& rng,
+                         int32_t length,
+                         Vector& hidden,
+                         int32_t& label) const {
+  if (offsets_.empty() || offsets_.back() == 0) {
+    return false;
+  }
+  const int64_t j = std::uniform_int_distribution<int64_t>(
+      0, offsets_.back() - 1)(rng);
+  const int32_t i =
+    std::upper_bound(offsets_.cbegin(), offsets_.cend(), j) - offsets_.cbegin() - 1;
+  const int64_t begin = j - offsets_[i];
+  const int64_t blocks = std::max<int64_t>(1, (length + stride_ / 2) / stride_);
+  const int64_t end = std::min(begin + blocks, valid_[i] - 1);
+  if (end <= begin) {
+    return false;
+  }
+  const uint32_t n = counts_[offsets_[i] + end] - counts_[offsets_[i] + begin];
+  if (n == 0) {
+    return false;
+  }
+  const real* anchorBegin =
+    anchors_.data() + (anchorOffsets_[i] + begin / anchorEvery_) * dim_;
+  const real* anchorEnd =
+    anchors_.data() + (anchorOffsets_[i] + end / anchorEvery_) * dim_;
+  const uint16_t* deltaBegin = deltas_.data() + (offsets_[i] + begin) * dim_;
+  const uint16_t* deltaEnd = deltas_.data() + (offsets_[i] + end) * dim_;
+  const real scale = 1.0 / n;
+  for (int64_t k = 0; k < dim_; k++) {
+    hidden[k] = (anchorEnd[k] - anchorBegin[k] +
+                 toFloat(deltaEnd[k]) - toFloat(deltaBegin[k])) * scale;
+  }
+  label = labels_[i];
+  return true;
+}
+
+// Returns the size of the cache in bytes
+int64_t PrefixCache::memory() const {
+  return counts_.size() * sizeof(uint32_t) + deltas_.size() * sizeof(uint16_t) +
+    anchors_.size() * sizeof(real) +
+    (offsets_.size() + valid_.size() + anchorOffsets_.size()) * sizeof(int64_t) +
+    labels_.size() * sizeof(int32_t);
+}
+
+}
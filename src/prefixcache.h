@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dictionary.h"
+#include "matrix.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+/*
+Embedding prefix sums
+With frozen embeddings, the hidden vector of a fragment is the difference
+of two prefix sums of the embeddings along its sequence, divided by the
+number of k-mers in between. The prefix sums and k-mer counts are kept
+every stride bases of every sequence, so that training fragments, which
+then start and end on a multiple of stride, cost O(dim) instead of one
+embedding row per k-mer.
+
+Sums are stored in fp16, relative to an fp32 anchor every ANCHOR_SPAN
+bases of the sequence, to bound the magnitude of the stored values.
+Checkpoint j of sequence i is global checkpoint offsets_[i] + j, valid if
+j < valid_[i]; it covers the first j * stride bases of the sequence.
+*/
+class PrefixCache {
+ protected:
+  static const int64_t ANCHOR_SPAN = 4096;
+
+  int32_t stride_;
+  int64_t anchorEvery_;
+  int64_t dim_;
+  std::vector<int64_t> offsets_;
+  std::vector<int64_t> valid_;
+  std::vector<int64_t> anchorOffsets_;
+  std::vector<int32_t> labels_;
+  std::vector<uint32_t> counts_;
+  std::vector<uint16_t> deltas_;
+  std::vector<real> anchors_;
+
+  void buildSequence(std::ifstream&, const Dictionary&, const Matrix&, int32_t,
+                     std::mt19937_64&, std::vector<index>&, std::vector<int32_t>&);
+
+ public:
+  explicit PrefixCache(int32_t);
+
+  void build(const std::string&, const Dictionary&, const Matrix&, int32_t);
+  bool sample(std::mt19937_64&, int32_t, Vector&, int32_t&) const;
+  int64_t memory() const;
+};
+
+}
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+
+namespace fasttext {
+
+// probabilities are rounded to multiples of 1 / LEVELS in the classes
+static const int32_t LEVELS = 15;
+
+// a class key is a sequence of labels and rounded probabilities
+struct ClassEntry {
+  int32_t label;
+  uint8_t probability;
+};
+
+Profiler::Profiler(int32_t nlabels)
+  : nlabels_(nlabels), reads_(nlabels, 0), probabilities_(nlabels, 0.0),
+    classified_(0) {}
+
+// Adds a read with predictions sorted by decreasing probability, in log
+void Profiler::add(const std::vector<std::pair<real, int32_t>>& predictions) {
+  if (predictions.empty()) {
+    return;
+  }
+  classified_++;
+  reads_[predictions[0].second]++;
+  std::vector<ClassEntry> entries;
+  for (auto it = predictions.cbegin(); it != predictions.cend(); ++it) {
+    const real p = std::exp(it->first);
+    probabilities_[it->second] += p;
+    // labels of negligible probability do not split the classes
+    const uint8_t rounded = std::lround(p * LEVELS);
+    if (rounded > 0 || entries.empty()) {
+      entries.push_back({it->second, std::max<uint8_t>(rounded, 1)});
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const ClassEntry& l, const ClassEntry& r) {
+              return l.label < r.label;
+            });
+  key_.resize(entries.size() * 5);
+  for (size_t i = 0; i < entries.size(); i++) {
+    memcpy(&key_[i * 5], &entries[i].label, 4);
+    key_[i * 5 + 4] = char(entries[i].probability);
+  }
+  classes_[key_]++;
+}
+
+void Profiler::merge(const Profiler& other) {
+  for (int32_t i = 0; i < nlabels_; i++) {
+    reads_[i] += other.reads_[i];
+    probabilities_[i] += other.probabilities_[i];
+  }
+  for (auto it = other.classes_.cbegin(); it != other.classes_.cend(); ++it) {
+    classes_[it->first] += it->second;
+  }
+  classified_ += other.classified_;
+}
+
+int64_t Profiler::classified() const {
+  return classified_;
+}
+
+int64_t Profiler::nclasses() const {
+  return classes_.size();
+}
+
+// Fractions of the summed probabilities
+std::vector<double> Profiler::abundances() const {
+  const double total =
+    std::accumulate(probabilities_.cbegin(), probabilities_.cend(), 0.0);
+  std::vector<double> abundances(nlabels_, 0.0);
+  for (int32_t i = 0; i < nlabels_ && total > 0; i++) {
+    abundances[i] = probabilities_[i] / total;
+  }
+  return abundances;
+}
+
+// Fractions of reads of every label after at most iterations of EM, with
+// the training counts of the labels as priors
+std::vector<double> Profiler::em(const std::vector<int64_t>& priors,
+                                 int32_t iterations) const {
+  const double total = std::accumulate(priors.cbegin(), priors.cend(), 0.0);
+  std::vector<int32_t> labels;
+  std::vector<double> likelihoods;
+  std::vector<int64_t> counts;
+  std::vector<size_t> offsets(1, 0);
+  for (auto it = classes_.cbegin(); it != classes_.cend(); ++it) {
+    for (size_t i = 0; i < it->first.size(); i += 5) {
+      int32_t label;
+      memcpy(&label, &it->first[i], 4);
+      const double prior = priors[label] > 0 ? priors[label] / total : 1.0;
+      labels.push_back(label);
+      likelihoods.push_back(uint8_t(it->first[i + 4]) / double(LEVELS) / prior);
+    }
+    counts.push_back(it->second);
+    offsets.push_back(labels.size());
+  }
+  std::vector<double> abundances = this->abundances();
+  std::vector<double> next(nlabels_);
+  for (int32_t iteration = 0; iteration < iterations; iteration++) {
+    std::fill(next.begin(), next.end(), 0.0);
+    for (size_t c = 0; c < counts.size(); c++) {
+      double z = 0.0;
+      for (size_t i = offsets[c]; i < offsets[c + 1]; i++) {
+        z += abundances[labels[i]] * likelihoods[i];
+      }
+      if (z <= 0) {
+        continue;
+      }
+      for (size_t i = offsets[c]; i < offsets[c + 1]; i++) {
+        next[labels[i]] += counts[c] * abundances[labels[i]] * likelihoods[i] / z;
+      }
+    }
+    const double sum = std::accumulate(next.cbegin(), next.cend(), 0.0);
+    double change = 0.0;
+    for (int32_t j = 0; j < nlabels_ && sum > 0; j++) {
+      next[j] /= sum;
+      change = std::max(change, std::abs(next[j] - abundances[j]));
+    }
+    abundances.swap(next);
+    if (change < 1e-7) {
+      break;
+    }
+  }
+  return abundances;
+}
+
+// Tab-separated table of the labels with reads or probabilities, by
+// decreasing abundance
+void Profiler::write(std::ostream& out,
+                     const Dictionary& dict,
+                     const std::vector<double>& abundances) const {
+  std::vector<int32_t> order;
+  for (int32_t i = 0; i < nlabels_; i++) {
+    if (reads_[i] > 0 || probabilities_[i] > 0 || abundances[i] > 0) {
+      order.push_back(i);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int32_t l, int32_t r) {
+    return abundances[l] > abundances[r];
+  });
+  out << "label\treads\tprobability\tabundance\n";
+  out << std::setprecision(6);
+  for (auto it = order.cbegin(); it != order.cend(); ++it) {
+    out << dict.getLabel(*it) << "\t" << reads_[*it] << "\t"
+        << probabilities_[*it] << "\t" << abundances[*it] << "\n";
+  }
+}
+
+}
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dictionary.h"
+#include "real.h"
+
+namespace fasttext {
+
+/*
+Abundance profile
+Accumulates, for every label, the reads whose top prediction is the label
+and the sum of the probabilities given to the label by the reads. Reads
+with the same top k labels and the same probabilities, rounded to 1/15,
+form an equivalence class kept as a single count, so that the memory is
+bounded by the number of distinct classes rather than of reads.
+
+The EM reassignment estimates the fraction of reads of every label from
+the classes: the probabilities of a read, divided by the prior of the
+labels in training (the length of their training sequences), are the
+likelihoods of its top k labels, and every read is shared between its
+labels in proportion to their likelihood times the current abundances.
+*/
+class Profiler {
+ protected:
+  int32_t nlabels_;
+  std::vector<int64_t> reads_;
+  std::vector<double> probabilities_;
+  // classes_ keys are the (label, rounded probability) pairs of a read
+  std::unordered_map<std::string, int64_t> classes_;
+  int64_t classified_;
+  std::string key_;
+
+ public:
+  explicit Profiler(int32_t);
+
+  void add(const std::vector<std::pair<real, int32_t>>&);
+  void merge(const Profiler&);
+
+  int64_t classified() const;
+  int64_t nclasses() const;
+  std::vector<double> abundances() const;
+  std::vector<double> em(const std::vector<int64_t>&, int32_t) const;
+  void write(std::ostream&, const Dictionary&, const std::vector<double>&) const;
+};
+
+}
@@ -0,0 +1,424 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+namespace fasttext {
+
+// Returns a socket bound to address, a port number for localhost TCP,
+// or a path for a Unix domain socket
+static int openSocket(const std::string& address, bool server) {
+  bool tcp = !address.empty() &&
+    address.find_first_not_of("0123456789") == std::string::npos;
+  int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot create socket: " + std::string(strerror(errno)));
+  }
+  int ret;
+  if (tcp) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(std::stoi(address));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (server) {
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      ret = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    } else {
+      ret = ::connect(fd, (struct sockaddr*) &addr, sizeof(addr));
+    }
+  } else {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(addr.sun_path)) {
+      close(fd);
+      throw std::invalid_argument(address + " is too long for a socket path!");
+    }
+    strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+    if (server) {
+      unlink(address.c_str());
+      ret = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    } else {
+      ret = ::connect(fd, (struct sockaddr*) &addr, sizeof(addr));
+    }
+  }
+  if (ret < 0) {
+    std::string error(strerror(errno));
+    close(fd);
+    throw std::runtime_error("Cannot open " + address + ": " + error);
+  }
+  return fd;
+}
+
+Server::Server(int32_t thread, int32_t batch, int32_t delay, int64_t maxLine)
+  : thread_(thread), batch_(batch), delay_(delay), maxLine_(maxLine),
+    stop_(false), nrequests_(0), nbatches_(0), maxBatch_(0) {
+  if (thread_ <= 0 || batch_ <= 0 || delay < 0) {
+    throw std::invalid_argument(
+        "Server needs at least one thread and a batch size of 1 or higher!");
+  }
+  if (maxLine_ <= 0) {
+    throw std::invalid_argument("Server needs a maximal line length of 1 or higher!");
+  }
+}
+
+void Server::addModel(const std::string& name, const std::string& path) {
+  auto fasttext = std::make_shared<FastText>();
+  fasttext->loadModel(path);
+  if (fasttext->getArgs().model != model_name::sup) {
+    throw std::invalid_argument(path + " is not a supervised model!");
+  }
+  ModelEntry& entry = models_[name];
+  entry.fasttext = fasttext;
+  // label names are looked up once, not for every reply
+  auto dict = fasttext->getDictionary();
+  entry.labels.clear();
+  for (int32_t i = 0; i < dict->nlabels(); i++) {
+    entry.labels.push_back(dict->getLabel(i));
+  }
+}
+
+int Server::connect(const std::string& address) {
+  return openSocket(address, false);
+}
+
+int Server::listen(const std::string& address) {
+  int fd = openSocket(address, true);
+  if (::listen(fd, 128) < 0) {
+    std::string error(strerror(errno));
+    close(fd);
+    throw std::runtime_error("Cannot listen on " + address + ": " + error);
+  }
+  return fd;
+}
+
+// Throws std::length_error if maxLine is set and the line is longer
+bool Server::readLine(int fd, std::string& buffer, std::string& line,
+                      int64_t maxLine) {
+  size_t eol;
+  while ((eol = buffer.find('\n')) == std::string::npos) {
+    if (maxLine > 0 && int64_t(buffer.size()) > maxLine) {
+      throw std::length_error(
+          "line longer than " + std::to_string(maxLine) + " bytes");
+    }
+    char chunk[65536];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (buffer.empty()) {
+        return false;
+      }
+      // last line without a newline
+      line.swap(buffer);
+      buffer.clear();
+      return true;
+    }
+    buffer.append(chunk, n);
+  }
+  if (maxLine > 0 && int64_t(eol) > maxLine) {
+    throw std::length_error(
+        "line longer than " + std::to_string(maxLine) + " bytes");
+  }
+  line.assign(buffer, 0, eol);
+  buffer.erase(0, eol + 1);
+  return true;
+}
+
+bool Server::writeAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+std::future<std::string> Server::handleLine(const std::string& line) {
+  std::istringstream iss(line);
+  std::string command;
+  iss >> command;
+  if (command == "predict") {
+    auto request = std::make_shared<Request>();
+    std::string name;
+    if (iss >> name >> request->k >> request->threshold >> request->sequence) {
+      auto it = models_.find(name);
+      if (it != models_.end() && request->k > 0) {
+        request->model = &it->second;
+        request->arrival = clock::now();
+        std::future<std::string> reply = request->reply.get_future();
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          queue_.push_back(request);
+        }
+        cv_.notify_one();
+        return reply;
+      }
+    }
+  }
+  std::promise<std::string> reply;
+  if (command == "models") {
+    std::string names;
+    for (auto it = models_.cbegin(); it != models_.cend(); ++it) {
+      if (it != models_.cbegin()) {
+        names += " ";
+      }
+      names += it->first;
+    }
+    reply.set_value(names);
+  } else if (command == "stats") {
+    reply.set_value(stats());
+  } else {
+    reply.set_value("error invalid request");
+  }
+  return reply.get_future();
+}
+
+// Replies are written by a second thread in the order of the requests,
+// so that a client can send all its reads before reading any reply.
+void Server::handleConnection(int fd) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::future<std::string>> replies;
+  bool done = false;
+
+  std::thread writer([&]() {
+    bool ok = true;
+    while (true) {
+      std::future<std::string> reply;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return done || !replies.empty(); });
+        if (replies.empty()) {
+          break;
+        }
+        reply = std::move(replies.front());
+        replies.pop_front();
+      }
+      std::string line = reply.get();
+      line.push_back('\n');
+      ok = ok && writeAll(fd, line);
+    }
+  });
+
+  auto push = [&](std::future<std::string> reply) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      replies.push_back(std::move(reply));
+    }
+    cv.notify_one();
+  };
+  std::string buffer, line;
+  try {
+    while (readLine(fd, buffer, line, maxLine_)) {
+      if (line.empty()) {
+        continue;
+      }
+      push(handleLine(line));
+    }
+  } catch (const std::length_error& e) {
+    // the rest of the line cannot be told from the next request
+    std::promise<std::string> reply;
+    reply.set_value("error " + std::string(e.what()));
+    push(reply.get_future());
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+  cv.notify_one();
+  writer.join();
+  close(fd);
+}
+
+void Server::batchThread() {
+  std::vector<std::shared_ptr<Request>> batch;
+  while (true) {
+    batch.clear();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      // wait for a full batch, or for the deadline of the oldest read
+      auto deadline = queue_.front()->arrival + delay_;
+      cv_.wait_until(lock, deadline, [&]() {
+        return stop_ || queue_.size() >= size_t(batch_);
+      });
+      while (!queue_.empty() && batch.size() < size_t(batch_)) {
+        batch.push_back(queue_.front());
+        queue_.pop_front();
+      }
+    }
+    if (!batch.empty()) {
+      processBatch(batch);
+    }
+  }
+}
+
+void Server::processBatch(std::vector<std::shared_ptr<Request>>& batch) {
+  // reads of the same model and parameters are scored together
+  std::stable_sort(batch.begin(), batch.end(),
+    [](const std::shared_ptr<Request>& l, const std::shared_ptr<Request>& r) {
+      return std::make_tuple(l->model, l->k, l->threshold) <
+             std::make_tuple(r->model, r->k, r->threshold);
+    });
+
+  std::vector<index> words;
+  std::vector<std::shared_ptr<Request>> rows;
+  std::vector<std::vector<std::pair<real, int32_t>>> heaps;
+  auto first = batch.begin();
+  while (first != batch.end()) {
+    auto last = first;
+    while (last != batch.end() && (*last)->model == (*first)->model &&
+           (*last)->k == (*first)->k &&
+           (*last)->threshold == (*first)->threshold) {
+      ++last;
+    }
+    const ModelEntry* entry = (*first)->model;
+    auto dict = entry->fasttext->getDictionary();
+    auto model = entry->fasttext->getModel();
+    const int32_t dim = entry->fasttext->getDimension();
+    Matrix hiddens(last - first, dim);
+    Vector hidden(dim);
+    rows.clear();
+    for (auto it = first; it != last; ++it) {
+      dict->readSequence((*it)->sequence, words);
+      if (words.empty()) {
+        (*it)->reply.set_value("");
+        continue;
+      }
+      model->computeHidden(words, hidden);
+      std::copy(hidden.data(), hidden.data() + dim,
+                hiddens.data() + rows.size() * dim);
+      rows.push_back(*it);
+    }
+    heaps.resize(rows.size());
+    if (!rows.empty()) {
+      model->predictBlock(hiddens, rows.size(), (*first)->k,
+                          (*first)->threshold, heaps.data(), nullptr);
+    }
+    for (size_t i = 0; i < rows.size(); i++) {
+      std::ostringstream reply;
+      for (auto it = heaps[i].cbegin(); it != heaps[i].cend(); ++it) {
+        if (it != heaps[i].cbegin()) {
+          reply << " ";
+        }
+        reply << entry->labels[it->second] << " " << std::exp(it->first);
+      }
+      rows[i]->reply.set_value(reply.str());
+    }
+    first = last;
+  }
+
+  auto now = clock::now();
+  std::lock_guard<std::mutex> lock(statsMutex_);
+  for (auto it = batch.cbegin(); it != batch.cend(); ++it) {
+    int64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - (*it)->arrival).count();
+    latencies_[nrequests_ % LATENCY_WINDOW] = latency;
+    nrequests_++;
+  }
+  nbatches_++;
+  maxBatch_ = std::max<int64_t>(maxBatch_, batch.size());
+}
+
+std::string Server::stats() {
+  size_t depth;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    depth = queue_.size();
+  }
+  std::vector<int64_t> latencies;
+  int64_t nrequests, nbatches, maxBatch;
+  {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    nrequests = nrequests_;
+    nbatches = nbatches_;
+    maxBatch = maxBatch_;
+    latencies.assign(latencies_.begin(),
+        latencies_.begin() + std::min<int64_t>(nrequests_, LATENCY_WINDOW));
+  }
+  // percentiles over the last LATENCY_WINDOW reads
+  auto percentile = [&latencies](double p) -> int64_t {
+    if (latencies.empty()) {
+      return 0;
+    }
+    size_t i = std::min(latencies.size() - 1, size_t(p * latencies.size()));
+    std::nth_element(latencies.begin(), latencies.begin() + i, latencies.end());
+    return latencies[i];
+  };
+  std::ostringstream out;
+  out << "{\"queue_depth\": " << depth
+      << ", \"requests\": " << nrequests
+      << ", \"batches\": " << nbatches
+      << ", \"mean_batch\": " << (nbatches > 0 ? double(nrequests) / nbatches : 0.0)
+      << ", \"max_batch\": " << maxBatch
+      << ", \"latency_us\": {\"p50\": " << percentile(0.5)
+      << ", \"p90\": " << percentile(0.9)
+      << ", \"p99\": " << percentile(0.99)
+      << ", \"max\": " << percentile(1.0) << "}}";
+  return out.str();
+}
+
+void Server::serve(const std::string& address) {
+  if (models_.empty()) {
+    throw std::invalid_argument("No model to serve!");
+  }
+  latencies_.assign(LATENCY_WINDOW, 0);
+  int fd = listen(address);
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < thread_; i++) {
+    threads.push_back(std::thread([=]() { batchThread(); }));
+  }
+  std::cerr << "Serving " << models_.size() << " model(s) on " << address << std::endl;
+  while (true) {
+    int client = accept(fd, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;
+    }
+    std::thread([=]() { handleConnection(client); }).detach();
+  }
+  close(fd);
+  stop_ = true;
+  cv_.notify_all();
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+}
+
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fasttext.h"
+#include "real.h"
+
+namespace fasttext {
+
+/*
+Classification server
+Keeps models resident and answers requests over a Unix domain socket, or
+over localhost TCP if the address is a port number. Each connection sends
+one request per line and receives one reply per line, in order:
+
+  predict <model> <k> <threshold> <sequence>   labels and probabilities
+  models                                       names of the loaded models
+  stats                                        JSON line of server statistics
+
+Predict requests of all connections are queued and grouped into
+micro-batches of at most batch_ reads, or fewer once the oldest read
+has waited delay_ microseconds. A connection sending a line longer than
+maxLine_ bytes is answered with an error and closed.
+*/
+class Server {
+ protected:
+  typedef std::chrono::steady_clock clock;
+
+  struct ModelEntry {
+    std::shared_ptr<const FastText> fasttext;
+    std::vector<std::string> labels;
+  };
+
+  struct Request {
+    const ModelEntry* model;
+    int32_t k;
+    real threshold;
+    std::string sequence;
+    clock::time_point arrival;
+    std::promise<std::string> reply;
+  };
+
+  std::map<std::string, ModelEntry> models_;
+
+  int32_t thread_;
+  int32_t batch_;
+  std::chrono::microseconds delay_;
+  int64_t maxLine_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<Request>> queue_;
+  std::atomic<bool> stop_;
+
+  // statistics, guarded by statsMutex_
+  static const int32_t LATENCY_WINDOW = 65536;
+  std::mutex statsMutex_;
+  int64_t nrequests_;
+  int64_t nbatches_;
+  int64_t maxBatch_;
+  std::vector<int64_t> latencies_;
+
+  void batchThread();
+  void processBatch(std::vector<std::shared_ptr<Request>>&);
+  void handleConnection(int);
+  std::future<std::string> handleLine(const std::string&);
+  std::string stats();
+
+ public:
+  Server(int32_t, int32_t, int32_t, int64_t);
+
+  void addModel(const std::string&, const std::string&);
+  void serve(const std::string&);
+
+  static int connect(const std::string&);
+  static int listen(const std::string&);
+  static bool readLine(int, std::string&, std::string&, int64_t = 0);
+  static bool writeAll(int, const std::string&);
+};
+
+}
@@ -0,0 +1,296 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "simulator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace fasttext {
+
+// reads are generated and written by chunks of this many reads
+static const int64_t CHUNK_SIZE = 16384;
+static const int32_t LINE_WIDTH = 80;
+static const char BASES[] = "ACGT";
+
+Simulator::Simulator()
+    : ngenomes(100),
+      nclades(10),
+      genomeLength(100000),
+      lengthSigma(0.3),
+      order(0),
+      divergence(0.05),
+      abundanceSigma(0.0),
+      nreads(1000000),
+      readLength(200),
+      noise(0),
+      thread(4),
+      seed(0) {}
+
+std::string Simulator::genomeLabel(int32_t i) const {
+  return "genome_" + std::to_string(i);
+}
+
+std::string Simulator::cladeLabel(int32_t c) const {
+  return "clade_" + std::to_string(c);
+}
+
+static inline char complement(char c) {
+  switch (c) {
+    case 'A': return 'T';
+    case 'C': return 'G';
+    case 'G': return 'C';
+    default: return 'A';
+  }
+}
+
+// Calls f(i) for i in [0, n) from thread threads
+template <typename F>
+static void parallelFor(int64_t n, int32_t thread, F f) {
+  std::atomic<int64_t> next(0);
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < thread; t++) {
+    threads.push_back(std::thread([&]() {
+      for (int64_t i = next++; i < n; i = next++) {
+        f(i);
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+void Simulator::randomSequence(std::string& seq,
+                               int64_t length,
+                               std::mt19937_64& rng) const {
+  seq.resize(length);
+  if (order == 0) {
+    for (int64_t i = 0; i < length; i += 32) {
+      uint64_t bits = rng();
+      for (int64_t j = i; j < std::min(length, i + 32); j++, bits >>= 2) {
+        seq[j] = BASES[bits & 3];
+      }
+    }
+    return;
+  }
+  // cumulative transition probabilities, drawn from a flat Dirichlet
+  const int32_t ncontexts = 1 << 2 * order;
+  std::vector<double> cdf(4 * ncontexts);
+  std::exponential_distribution<double> exponential(1.0);
+  for (int32_t c = 0; c < ncontexts; c++) {
+    double sum = 0;
+    for (int32_t b = 0; b < 4; b++) {
+      sum += exponential(rng);
+      cdf[4 * c + b] = sum;
+    }
+    for (int32_t b = 0; b < 4; b++) {
+      cdf[4 * c + b] /= sum;
+    }
+  }
+  std::uniform_real_distribution<double> uniform(0, 1);
+  uint32_t context = 0;
+  for (int64_t i = 0; i < length; i++) {
+    int32_t b = rng() & 3;
+    if (i >= order) {
+      const double u = uniform(rng);
+      const double* p = cdf.data() + 4 * context;
+      b = (u >= p[0]) + (u >= p[1]) + (u >= p[2]);
+    }
+    seq[i] = BASES[b];
+    context = ((context << 2) | b) & (ncontexts - 1);
+  }
+}
+
+// Replaces each base, with probability rate < 1, by a uniformly random base
+void Simulator::mutate(std::string& seq,
+                       double rate,
+                       std::mt19937_64& rng) const {
+  if (rate <= 0) {
+    return;
+  }
+  std::geometric_distribution<int64_t> gap(rate);
+  for (int64_t i = gap(rng); i < seq.size(); i += 1 + gap(rng)) {
+    seq[i] = BASES[rng() & 3];
+  }
+}
+
+void Simulator::generateGenome(int32_t i,
+                               const std::string& ancestor,
+                               int64_t length) {
+  // each genome is a mutated segment of its clade's ancestor
+  std::seed_seq genomeSeed{seed, uint32_t(1), uint32_t(i)};
+  std::mt19937_64 rng(genomeSeed);
+  std::uniform_int_distribution<int64_t> offset(0, ancestor.size() - length);
+  genomes_[i] = ancestor.substr(offset(rng), length);
+  mutate(genomes_[i], divergence, rng);
+}
+
+void Simulator::generateReads(int64_t chunk,
+                              std::string& fasta,
+                              std::string& labels) const {
+  std::seed_seq chunkSeed{seed, uint32_t(2), uint32_t(chunk)};
+  std::mt19937_64 rng(chunkSeed);
+  std::discrete_distribution<int32_t> genome(weights_.begin(), weights_.end());
+  const int64_t first = chunk * CHUNK_SIZE;
+  const int64_t last = std::min(nreads, first + CHUNK_SIZE);
+  std::string read(readLength, 'A');
+  fasta.clear();
+  labels.clear();
+  for (int64_t r = first; r < last; r++) {
+    const int32_t g = genome(rng);
+    const std::string& seq = genomes_[g];
+    const int64_t pos = std::uniform_int_distribution<int64_t>(
+        0, seq.size() - readLength)(rng);
+    const bool reverse = rng() & 1;
+    if (reverse) {
+      for (int32_t j = 0; j < readLength; j++) {
+        read[j] = complement(seq[pos + readLength - 1 - j]);
+      }
+    } else {
+      read.assign(seq, pos, readLength);
+    }
+    mutate(read, noise / 100000.0, rng);
+    fasta += ">read_";
+    fasta += std::to_string(r);
+    fasta += ' ';
+    fasta += labels_[g];
+    fasta += ':';
+    fasta += std::to_string(pos);
+    fasta += reverse ? ":-\n" : ":+\n";
+    fasta += read;
+    fasta += '\n';
+    labels += labels_[g];
+    labels += '\n';
+  }
+}
+
+static void openOutput(std::ofstream& ofs, const std::string& path) {
+  ofs.open(path);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(path + " cannot be opened for saving!");
+  }
+}
+
+void Simulator::simulate(const std::string& prefix) {
+  if (ngenomes <= 0 || nclades <= 0 || nclades > ngenomes) {
+    throw std::invalid_argument(
+        "The number of clades must be between 1 and the number of genomes");
+  }
+  if (order < 0 || order > 12) {
+    throw std::invalid_argument("Markov order must be between 0 and 12");
+  }
+  if (readLength <= 0 || genomeLength < readLength) {
+    throw std::invalid_argument(
+        "Genome length must be at least the read length");
+  }
+  // the gaps between mutations are geometric, which needs a rate below 1
+  if (divergence < 0 || divergence >= 1 || noise < 0 || noise >= 100000) {
+    throw std::invalid_argument(
+        "Divergence must be in [0, 1) and noise in [0, 100000)");
+  }
+  thread = std::max(thread, 1);
+
+  std::seed_seq globalSeed{seed, uint32_t(3)};
+  std::mt19937_64 rng(globalSeed);
+  std::normal_distribution<double> normal(0, 1);
+  std::vector<int64_t> lengths(ngenomes);
+  std::vector<double> abundances(ngenomes);
+  clades_.resize(ngenomes);
+  weights_.resize(ngenomes);
+  labels_.resize(ngenomes);
+  double total = 0;
+  for (int32_t i = 0; i < ngenomes; i++) {
+    lengths[i] = std::max<int64_t>(
+        readLength, std::llround(genomeLength * std::exp(lengthSigma * normal(rng))));
+    abundances[i] = std::exp(abundanceSigma * normal(rng));
+    clades_[i] = i % nclades;
+    labels_[i] = genomeLabel(i);
+    weights_[i] = lengths[i] * abundances[i];
+    total += weights_[i];
+  }
+
+  // the ancestor of a clade is as long as its longest genome
+  std::vector<std::string> ancestors(nclades);
+  parallelFor(nclades, thread, [&](int64_t c) {
+    int64_t length = 0;
+    for (int32_t i = c; i < ngenomes; i += nclades) {
+      length = std::max(length, lengths[i]);
+    }
+    std::seed_seq cladeSeed{seed, uint32_t(0), uint32_t(c)};
+    std::mt19937_64 cladeRng(cladeSeed);
+    randomSequence(ancestors[c], length, cladeRng);
+  });
+  genomes_.assign(ngenomes, std::string());
+  parallelFor(ngenomes, thread, [&](int64_t i) {
+    generateGenome(i, ancestors[clades_[i]], lengths[i]);
+  });
+  ancestors.clear();
+
+  std::ofstream genomes, genomeLabels, taxonomy, abundance;
+  openOutput(genomes, prefix + ".genomes.fasta");
+  openOutput(genomeLabels, prefix + ".genomes.labels");
+  openOutput(taxonomy, prefix + ".taxonomy");
+  openOutput(abundance, prefix + ".abundance");
+  for (int32_t i = 0; i < ngenomes; i++) {
+    genomes << ">" << genomeLabel(i) << "\n";
+    for (int64_t j = 0; j < genomes_[i].size(); j += LINE_WIDTH) {
+      genomes.write(genomes_[i].data() + j,
+                    std::min<int64_t>(LINE_WIDTH, genomes_[i].size() - j));
+      genomes << "\n";
+    }
+    genomeLabels << genomeLabel(i) << "\n";
+    taxonomy << genomeLabel(i) << "\t" << cladeLabel(clades_[i]) << "\n";
+    abundance << genomeLabel(i) << "\t" << weights_[i] / total << "\n";
+  }
+  genomes.close();
+  genomeLabels.close();
+  taxonomy.close();
+  abundance.close();
+
+  // chunk c is generated by thread c % thread, and chunks are written in
+  // order so that the output does not depend on the number of threads
+  std::ofstream reads, readLabels;
+  openOutput(reads, prefix + ".reads.fasta");
+  openOutput(readLabels, prefix + ".reads.labels");
+  const int64_t nchunks = (nreads + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  std::mutex mutex;
+  std::condition_variable cv;
+  int64_t nextChunk = 0;
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < thread; t++) {
+    threads.push_back(std::thread([&, t]() {
+      std::string fasta, labels;
+      for (int64_t c = t; c < nchunks; c += thread) {
+        generateReads(c, fasta, labels);
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return nextChunk == c; });
+        reads.write(fasta.data(), fasta.size());
+        readLabels.write(labels.data(), labels.size());
+        nextChunk++;
+        cv.notify_all();
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  if (!reads || !readLabels) {
+    throw std::runtime_error("Error while writing the reads of " + prefix);
+  }
+}
+
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fasttext {
+
+/*
+Synthetic genomes and reads
+Genomes are grouped into clades: each clade has an ancestral genome, drawn
+from a Markov chain of the given order whose transition probabilities are
+drawn per clade (order 0 with uniform probabilities gives i.i.d. bases),
+and each genome is a copy of a random segment of its ancestor with
+substitutions at rate divergence. Genome lengths follow a log-normal
+distribution of median genomeLength.
+
+Reads are drawn from either strand of a genome chosen with probability
+proportional to its length times its abundance, itself log-normal, and
+mutated with the noise model of training: each base is replaced, with
+probability noise / 100000, by a uniformly random base.
+
+Everything is derived from seed, so that the output does not depend on
+the number of threads. For a prefix p, the files written are:
+
+  p.genomes.fasta  p.genomes.labels   reference genomes, one label each
+  p.reads.fasta    p.reads.labels     reads, one label per read
+  p.taxonomy                          genome label and clade label per line
+  p.abundance                         genome label and fraction of reads
+*/
+class Simulator {
+ protected:
+  std::vector<std::string> genomes_;
+  std::vector<int32_t> clades_;
+  std::vector<double> weights_;
+  std::vector<std::string> labels_;
+
+  std::string genomeLabel(int32_t) const;
+  std::string cladeLabel(int32_t) const;
+  void randomSequence(std::string&, int64_t, std::mt19937_64&) const;
+  void mutate(std::string&, double, std::mt19937_64&) const;
+  void generateGenome(int32_t, const std::string&, int64_t);
+  void generateReads(int64_t, std::string&, std::string&) const;
+
+ public:
+  int32_t ngenomes;
+  int32_t nclades;
+  int64_t genomeLength;
+  double lengthSigma;
+  int32_t order;
+  double divergence;
+  double abundanceSigma;
+  int64_t nreads;
+  int32_t readLength;
+  int32_t noise;
+  int32_t thread;
+  uint32_t seed;
+
+  Simulator();
+
+  void simulate(const std::string&);
+};
+
+}
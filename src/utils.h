@@ -25,6 +25,8 @@ namespace utils {
 
   int64_t size(std::ifstream&);
   void seek(std::ifstream&, int64_t);
+  // splitmix64 finalizer, a cheap bijective 64-bit mixer
+  uint64_t mix64(uint64_t);
 }
 
 }
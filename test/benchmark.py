@@ -0,0 +1,191 @@
+'''
+End-to-end throughput benchmark of fastdna.
+
+Generates a synthetic dataset with `fastdna simulate`, then for every
+k-mer length and dimension runs the real commands:
+  supervised  at each thread count: fragments/sec, wall time, peak RSS
+  quantize    wall time, peak RSS, model size
+  test        reads/sec, P@1 and peak RSS, for the .bin and .ftz models
+  predict     reads/sec
+  load        time to load the .bin and .ftz models (predict on no reads)
+The results are written to a JSON report. With -baseline, every metric is
+compared to a previous report, and the script exits with status 1 if one
+of them regressed by more than -tolerance.
+
+Usage (from the test directory, after `make`):
+  python3 benchmark.py -threads 1,8,32 -k 10,12 -dim 10,50 -report report.json
+  python3 benchmark.py -baseline report.json
+'''
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+parser = argparse.ArgumentParser(description="end-to-end benchmark of fastdna")
+parser.add_argument("-fastdna", help="fastdna binary",
+                    type=str, default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "fastdna"))
+parser.add_argument("-output_dir", help="directory for the data and models",
+                    type=str, default="output/benchmark")
+# Sweep
+parser.add_argument("-threads", help="comma-separated thread counts for training",
+                    type=str, default="1,8,32")
+parser.add_argument("-k", help="comma-separated k-mer lengths",
+                    type=str, default="10,12")
+parser.add_argument("-dim", help="comma-separated embedding dimensions",
+                    type=str, default="10,50")
+# Data
+parser.add_argument("-genomes", help="number of simulated genomes",
+                    type=int, default=100)
+parser.add_argument("-genome_length", help="median genome length",
+                    type=int, default=100000)
+parser.add_argument("-reads", help="number of simulated test reads",
+                    type=int, default=200000)
+parser.add_argument("-L", help="read length, for training and test",
+                    type=int, default=200)
+parser.add_argument("-e", help="number of training epochs",
+                    type=int, default=5)
+parser.add_argument("-lr", help="learning rate",
+                    type=float, default=0.1)
+# Report
+parser.add_argument("-report", help="JSON report to write",
+                    type=str, default="benchmark.json")
+parser.add_argument("-baseline", help="JSON report to compare against",
+                    type=str)
+parser.add_argument("-tolerance", help="relative change counted as a regression",
+                    type=float, default=0.1)
+
+# Whether larger values of a metric are better
+HIGHER_IS_BETTER = {
+    "fragments_per_sec": True,
+    "reads_per_sec": True,
+    "precision": True,
+    "wall_time": False,
+    "peak_rss_mb": False,
+    "load_time": False,
+    "model_size_mb": False,
+}
+
+
+def run(cmd, stdout=subprocess.DEVNULL):
+    '''
+    Runs cmd, returns its wall time in seconds, peak RSS in MB and output
+    '''
+    start = time.time()
+    p = subprocess.Popen(cmd, stdout=stdout, stderr=subprocess.DEVNULL)
+    out = p.stdout.read().decode() if stdout == subprocess.PIPE else ''
+    _, status, rusage = os.wait4(p.pid, 0)
+    wall = time.time() - start
+    if status != 0:
+        sys.exit("Command failed: " + " ".join(cmd))
+    return wall, rusage.ru_maxrss / 1024., out
+
+
+def parse_precision(out):
+    for line in out.splitlines():
+        if line.startswith("P@1"):
+            return float(line.split()[1])
+    return None
+
+
+def benchmark(args):
+    fastdna = args.fastdna
+    os.makedirs(args.output_dir, exist_ok=True)
+    data = os.path.join(args.output_dir, "sim")
+    run([fastdna, "simulate", data, "-genomes", str(args.genomes),
+         "-genomeLength", str(args.genome_length), "-reads", str(args.reads),
+         "-readLength", str(args.L)])
+    empty = os.path.join(args.output_dir, "empty.fasta")
+    open(empty, "w").close()
+
+    results = []
+
+    def record(stage, k, dim, thread, **metrics):
+        entry = {"stage": stage, "k": k, "dim": dim, "thread": thread}
+        entry.update(metrics)
+        results.append(entry)
+        print(" ".join("{}={}".format(key, round(v, 4) if isinstance(v, float) else v)
+                       for key, v in entry.items()))
+
+    threads = [int(t) for t in args.threads.split(",")]
+    for k in [int(k) for k in args.k.split(",")]:
+        for dim in [int(d) for d in args.dim.split(",")]:
+            model = os.path.join(args.output_dir, "model_k{}_d{}".format(k, dim))
+            for thread in threads:
+                stats = model + ".stats.jsonl"
+                if os.path.exists(stats):
+                    os.remove(stats)
+                wall, rss, _ = run([
+                    fastdna, "supervised", "-input", data + ".genomes.fasta",
+                    "-labels", data + ".genomes.labels", "-output", model,
+                    "-minn", str(k), "-dim", str(dim), "-epoch", str(args.e),
+                    "-lr", str(args.lr), "-length", str(args.L),
+                    "-thread", str(thread), "-verbose", "0",
+                    "-statsFile", stats, "-statsInterval", "3600"])
+                with open(stats) as f:
+                    final = json.loads(f.read().splitlines()[-1])
+                record("train", k, dim, thread, wall_time=wall, peak_rss_mb=rss,
+                       fragments_per_sec=final["fragments_per_sec"])
+
+            wall, rss, _ = run([fastdna, "quantize", "-input", data + ".genomes.fasta",
+                                "-output", model, "-verbose", "0"])
+            record("quantize", k, dim, 1, wall_time=wall, peak_rss_mb=rss,
+                   model_size_mb=os.path.getsize(model + ".ftz") / 2.**20)
+
+            load = {}
+            for ext in [".bin", ".ftz"]:
+                load[ext], _, _ = run([fastdna, "predict", model + ext, empty])
+                wall, rss, out = run([fastdna, "test", model + ext,
+                                      data + ".reads.fasta", data + ".reads.labels"],
+                                     stdout=subprocess.PIPE)
+                record("test" + ext, k, dim, 1, wall_time=wall, peak_rss_mb=rss,
+                       load_time=load[ext],
+                       reads_per_sec=args.reads / max(wall - load[ext], 1e-9),
+                       precision=parse_precision(out))
+
+            wall, rss, _ = run([fastdna, "predict", model + ".bin", data + ".reads.fasta"])
+            record("predict", k, dim, 1, wall_time=wall, peak_rss_mb=rss,
+                   reads_per_sec=args.reads / max(wall - load[".bin"], 1e-9))
+    return results
+
+
+def compare(results, baseline, tolerance):
+    '''
+    Prints the relative change of every metric, returns the regressions
+    '''
+    key = lambda e: (e["stage"], e["k"], e["dim"], e["thread"])
+    reference = {key(e): e for e in baseline}
+    regressions = []
+    print("\n{:<12} {:>4} {:>5} {:>7} {:<18} {:>12} {:>12} {:>8}".format(
+        "stage", "k", "dim", "thread", "metric", "baseline", "current", "change"))
+    for entry in results:
+        base = reference.get(key(entry))
+        if base is None:
+            continue
+        for metric, higher in HIGHER_IS_BETTER.items():
+            if entry.get(metric) is None or not base.get(metric):
+                continue
+            change = entry[metric] / base[metric] - 1
+            regressed = (-change if higher else change) > tolerance
+            if regressed:
+                regressions.append((key(entry), metric))
+            print("{:<12} {:>4} {:>5} {:>7} {:<18} {:>12.4g} {:>12.4g} {:>+7.1%}{}".format(
+                entry["stage"], entry["k"], entry["dim"], entry["thread"], metric,
+                base[metric], entry[metric], change, " REGRESSION" if regressed else ""))
+    return regressions
+
+
+if __name__ == "__main__":
+    args = parser.parse_args()
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)["results"]
+    results = benchmark(args)
+    report = {"args": vars(args), "results": results}
+    with open(args.report, "w") as f:
+        json.dump(report, f, indent=1)
+    if baseline is not None:
+        if compare(results, baseline, args.tolerance):
+            sys.exit(1)
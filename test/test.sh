@@ -28,4 +28,61 @@ $fastdna supervised -input $train_dataset -labels $train_labels -output $model_p
 
 # Test the model
 echo "Testing model $model_name"
-$fastdna test $model_path.bin $test_dataset $test_labels
\ No newline at end of file
+$fastdna test $model_path.bin $test_dataset $test_labels
+# Deterministic training gives the same model for the same seed and number
+# of threads
+echo "Checking deterministic training"
+for run in 1 2; do
+  $fastdna supervised -input $train_dataset -labels $train_labels -output ${model_path}_det$run -minn $k -dim $d -epoch $e -thread $threads -deterministic -verbose 0
+done
+if ! cmp -s ${model_path}_det1.bin ${model_path}_det2.bin; then
+  echo "Deterministic training gave different models!"
+  exit 1
+fi
+
+# A training interrupted after its first checkpoint and resumed from it
+# trains the remaining fragments only
+echo "Checking checkpoints"
+# about a million fragments, a few seconds, to be interrupted
+ce=$((1000000 / ($(wc -c < $train_dataset) / L) + 1))
+checkpoint_args="-input $train_dataset -labels $train_labels -output ${model_path}_ckpt -minn $k -dim $d -epoch $ce -length $L -thread $threads"
+rm -f ${model_path}_ckpt.checkpoint ${model_path}_ckpt.jsonl
+$fastdna supervised $checkpoint_args -checkpointInterval 1 -verbose 0 &
+pid=$!
+while [ ! -f ${model_path}_ckpt.checkpoint ] && kill -0 $pid 2> /dev/null; do
+  sleep 0.2
+done
+if ! kill -9 $pid 2> /dev/null; then
+  echo "Training ended before its first checkpoint!"
+  exit 1
+fi
+wait $pid 2> /dev/null
+start=$($fastdna supervised $checkpoint_args -resume -verbose 1 -statsFile ${model_path}_ckpt.jsonl 2>&1 |
+  sed -n 's/^Resuming from fragment //p')
+fragments=$(tail -n 1 ${model_path}_ckpt.jsonl | sed 's/.*"fragments": \([0-9]*\).*/\1/')
+# as startThreads, up to lrUpdateRate (100) fragments per thread apart
+total=$((ce * ($(wc -c < $train_dataset) / L)))
+if [ -z "$start" ] || [ "$start" -le 0 ] ||
+   [ $((start + fragments - total)) -gt $((101 * threads)) ] ||
+   [ $((total - start - fragments)) -gt $((101 * threads)) ]; then
+  echo "Resumed training from fragment $start trained $fragments of $total fragments!"
+  exit 1
+fi
+
+# Paired-end reads give the same predictions with their mates in a second
+# file or interleaved; the mates are the test reads in reverse order
+echo "Checking paired-end prediction"
+mates_dataset="$output_path/mates.fasta"
+interleaved_dataset="$output_path/interleaved.fasta"
+awk 'BEGIN { RS = ">" } NR > 1 { r[NR] = $0 } END { for (i = NR; i > 1; i--) printf ">%s", r[i] }' \
+  $test_dataset > $mates_dataset
+awk 'BEGIN { RS = ">" } NR == FNR { if (FNR > 1) r[FNR] = $0; next } FNR > 1 { printf ">%s>%s", r[FNR], $0 }' \
+  $test_dataset $mates_dataset > $interleaved_dataset
+for mode in "" "-average"; do
+  $fastdna predict-paired-prob $model_path.bin $test_dataset 3 -mates $mates_dataset $mode > $output_path/mates.txt
+  $fastdna predict-paired-prob $model_path.bin $interleaved_dataset 3 $mode > $output_path/interleaved.txt
+  if [ ! -s $output_path/mates.txt ] || ! cmp -s $output_path/mates.txt $output_path/interleaved.txt; then
+    echo "Paired-end predictions $mode differ between -mates and interleaved reads!"
+    exit 1
+  fi
+done